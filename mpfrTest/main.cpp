@@ -19,19 +19,33 @@
 #include <algorithm>
 
 #include <windows.h>
+#include <winternl.h>
+#include <intrin.h>
 #include <comdef.h>
 #include <Wbemidl.h>
 
 #include "Profiler.h"
 
 #include <mutex>
+#include <atomic>
+#include <memory>
+#include <random>
 #include <chrono>
 #include <queue>
 #include <functional>
 #include <condition_variable>
+#include <coroutine>
+#include <span>
+#include <psapi.h>
+#include <timeapi.h>
 
 #include <limits>
 #undef max
+#undef min
+
+#ifndef STATUS_INFO_LENGTH_MISMATCH
+#define STATUS_INFO_LENGTH_MISMATCH ((NTSTATUS)0xC0000004L)
+#endif
 
 typedef mpfr::mpreal mpreal;
 
@@ -41,12 +55,33 @@ typedef mpfr::mpreal mpreal;
 #define NUMBER_OF_TESTS 10
 #define PERFORMANCE_LIMIT 5
 
+#define BBP_START_POSITION 10000
+
+#define ARITHMETIC_SECONDS 0.2f
+#define ARITHMETIC_OPERANDS 3
+
+#define SEARCH_MIN_SAMPLES 3
+#define SEARCH_MAX_SAMPLES 7
+#define MAX_THREADS_CAP 8192
+
+#define PI_GUARD_DIGITS 10
+#define PI_DIGITS_PER_TERM 14
+#define PI_LIVE_VALUES 6
+#define PI_MAX_EXPONENT 6
+
 //cpu specs
 int numCores;
 char cpuName[256];
 unsigned int frequency;
+unsigned int cacheSize[3];
 
 unsigned int GetCpuFrequency();
+long long GetProcessContextSwitches();
+double GetProcessCpuSeconds();
+double GetThreadCpuSeconds();
+long long GetProcessPrivateBytes();
+void GetCacheSizes();
+const char* cacheLevelName(long long bytes);
 void cpuSpecsPrint();
 void cpuSpecs();
 
@@ -54,21 +89,113 @@ void cpuSpecs();
 Profiler paralelismTimes("paralelism");
 void graphParalelism(int nr_threads, int& score);
 
+Profiler piDigitsTimes("pi-digits");
+void graphPiDigits(int maxExponent, int& score);
+
+Profiler maxThreadsTimes("max-threads");
+
+Profiler arithmeticTimes("arithmetic");
+void graphArithmetic(int maxPrecision, int& score);
+
+Profiler openLoopTimes("open-loop");
+
+Profiler elasticTimes("elastic-pool");
+
+Profiler utilizationTimes("utilization");
+
 //tests
 float measureMultitaskingSpeed(int n);
-int measureMaxThreads(int n, int prec, int& score);
+enum PiWorkload { PI_CHUDNOVSKY = 1, PI_BBP = 2 };
+int measureMaxThreads(int n, int digits, int resolution, PiWorkload workload, int& score);
 float measureEncryption(int nrTest, bool en, int key, int n, int len, Operation& op);
 float measureParalelism(std::vector<std::thread> threads, Operation& op);
 
 //nthDigitPi
 mpreal sqrt_custom(mpreal n, mpreal m);
 mpreal power(int n);
-mpreal pi(int prec);
-void nthDigitPi(int n, int prec);
-void threadDigitPi(int n, int prec, int nrThreads);
+mpreal pi(int digits);
+long long piWorkingSetBytes(int digits);
+int nthDigitPi(int n, int digits);
+
+//bbp
+long long modPow16(long long exponent, long long modulus);
+double bbpSeries(int j, int n);
+int bbpHexDigit(int position);
+int bbpDigits(int start, int count);
+
+//arithmetic
+enum ArithmeticOp { OP_ADD, OP_MUL, OP_DIV, OP_SQRT, OP_EXP, OP_LOG, OP_COUNT };
+const char* arithmeticOpNames[OP_COUNT] = { "add", "mul", "div", "sqrt", "exp", "log" };
+
+struct ArithmeticResult {
+	long long ops;
+	float seconds;
+};
+
+ArithmeticResult runArithmetic(ArithmeticOp op, mp_prec_t precision, float budget);
+ArithmeticResult measureArithmetic(ArithmeticOp op, mp_prec_t precision, int nrThreads);
+
+//max threads
+struct ThreadRunStats {
+	float makespan;
+	float minLatency;
+	float maxLatency;
+	float meanLatency;
+	float stdLatency;
+	float startSkew;
+	long long contextSwitches;
+	int created;
+};
+
+class ThreadGate {
+private:
+	std::mutex gateMutex;
+	std::condition_variable arrived;
+	std::condition_variable opened;
+	int waiting;
+	bool open;
+
+public:
+	ThreadGate() : waiting(0), open(false) {}
+
+	// called by the worker threads, blocks until the gate is opened
+	void arriveAndWait() {
+		std::unique_lock<std::mutex> lock(gateMutex);
+		waiting++;
+		arrived.notify_one();
+		opened.wait(lock, [this] { return open; });
+	}
+
+	// called by the main thread, blocks until count threads are parked at the gate
+	void waitFor(int count) {
+		std::unique_lock<std::mutex> lock(gateMutex);
+		arrived.wait(lock, [this, count] { return waiting >= count; });
+	}
+
+	void release() {
+		{
+			std::lock_guard<std::mutex> lock(gateMutex);
+			open = true;
+		}
+		opened.notify_all();
+	}
+};
+
+struct ThreadProbe {
+	int nrThreads;
+	int samples;
+	float makespan;
+	float ratio;
+	float ratioLow;
+	float ratioHigh;
+	bool exceeds;
+	bool capped;
+};
+
+ThreadRunStats threadDigitPi(int n, int digits, int nrThreads, PiWorkload workload);
+ThreadProbe probeMaxThreads(int n, int digits, int nrThreads, PiWorkload workload, float baseline, int minSamples);
 
 //encryption
-std::mutex enMutex;
 
 char msg[100000000];
 char en[10000000];
@@ -80,264 +207,2965 @@ void encryption_key(long int keys[2], int x, int y, int t);
 long int cd(long int a, int t);
 void encrypt(long int key, int n, int start, int finish);
 void decrypt(long int key, int n, int start, int finish);
+void encryptChunk(long int key, int n, const char* in, char* out, int len);
 void encryption(int x, int y, const int nr_threads, Operation& opEn, Operation& opDe, float& enTime, float& deTime);
 
 //load balancing
-std::mutex coutMutex;
-
-struct Task {
-	int id;
-	int processingTime;
-
-	Task(int taskId, int time) : id(taskId), processingTime(time) {}
-};
-
-class LoadBalancer {
+#define DEQUE_CAPACITY 4096
+#define INJECTION_BATCH 32
+#define MPMC_CAPACITY 65536
+#define WAKEUP_SAMPLES 100
+#define MAX_SWEEP_WORKERS 256
+#define SPIN_CALIBRATION_ITERATIONS (1 << 22)
+#define HISTOGRAM_SUB_BUCKET_BITS 7
+#define HISTOGRAM_MAX_BITS 42
+#define MAX_BATCH 256
+#define SHARD_SPREAD_INTERVAL 64
+#define MAX_PRODUCERS 64
+#define BACKPRESSURE_SPINS 4096
+#define OVERLOAD_FACTOR 1.5
+#define MIXED_LOAD 0.95
+#define INTERACTIVE_FRACTION 0.2
+#define BATCH_WORK_FACTOR 4
+#define INTERACTIVE_DEADLINE_FACTOR 10
+#define BATCH_DEADLINE_FACTOR 200
+#define IDLE_LOAD 0.2
+#define REUSE_ROUNDS 10
+#define OPEN_LOOP_SECONDS 2.0
+#define OPEN_LOOP_MIN_TASKS 200
+#define OPEN_LOOP_SLEEP_NS 2000000
+#define OPEN_LOOP_MEAN_BURST 8
+#define KNEE_FACTOR 5
+#define ELASTIC_CHECK_NS 1000000
+#define ELASTIC_SCALE_UP_DEPTH 4
+#define ELASTIC_SCALE_UP_WAIT_NS 5000000
+#define ELASTIC_IDLE_MS 50
+#define ELASTIC_PHASE_SECONDS 1.0
+#define TIMER_TICK_NS 1000000
+#define TIMER_WHEEL_SLOTS 1024
+#define ASYNC_IO_STEPS 3
+#define ASYNC_IO_MS 200
+#define DEPTH_SAMPLE_NS 1000000
+#define MAX_TIMELINE_POINTS 200
+#define UTILIZATION_BAR_WIDTH 40
+#define TRACE_FILE "loadbalancer.trace"
+#define TRACE_VERSION 1
+#define TRACE_PRODUCERS 2
+#define TRACE_LOAD 0.8
+
+long long timestampNs();
+
+enum TaskKind { TASK_SLEEP, TASK_SPIN, TASK_STREAM, TASK_CHASE, TASK_PI, TASK_ENCRYPT, TASK_KIND_COUNT };
+const char* taskKindNames[TASK_KIND_COUNT] = { "sleep", "spin", "memory stream", "pointer chase", "pi slice", "encrypt chunk" };
+const char* taskKindUnits[TASK_KIND_COUNT] = { "milliseconds", "cycles", "bytes", "bytes", "digits", "characters" };
+const int taskKindDefaultWork[TASK_KIND_COUNT] = { 100, 1000000, 262144, 262144, 1000, 100000 };
+
+// class 0 is served first by the priority modes, the FIFO backends ignore it
+#define PRIORITY_CLASSES 2
+const char* priorityClassNames[PRIORITY_CLASSES] = { "interactive", "batch" };
+const int priorityClassWeights[PRIORITY_CLASSES] = { 4, 1 };
+
+enum TaskState { TASK_PENDING, TASK_DONE, TASK_CANCELLED };
+
+// shared by a submitted task and its future, whichever lets go last frees it
+class TaskCompletion {
 private:
-	std::vector<std::thread> workers;
-	std::queue<Task> taskQueue;
-	std::mutex queueMutex;
-	std::condition_variable condition;
-	bool stop;
+	std::atomic<int> refs;
+	std::atomic<int> state;
+	std::atomic<int> waiters;
+	long long completionTime;
+	std::mutex mutex;
+	std::condition_variable done;
 
-	void workerFunction(int workerId) {
-		while (true) {
-			std::unique_lock<std::mutex> lock(queueMutex);
+public:
+	TaskCompletion() : refs(2), state(TASK_PENDING), waiters(0), completionTime(0) {}
 
-			condition.wait(lock, [this] { return !taskQueue.empty() || stop; });
+	void addRef() {
+		refs++;
+	}
 
-			if (taskQueue.empty() && stop) {
-				break;
-			}
+	void release() {
+		if (--refs == 0) {
+			delete this;
+		}
+	}
 
-			Task task = taskQueue.front();
-			taskQueue.pop();
+	// drops the task's reference, so the task must not touch it afterwards
+	void complete(TaskState result, long long time) {
+		completionTime = time;
+		state.store(result);
+		// waiters is raised before the state is checked, so either the waiter sees the result or we see the waiter
+		if (waiters.load() > 0) {
+			std::lock_guard<std::mutex> lock(mutex);
+			done.notify_all();
+		}
+		release();
+	}
 
-			lock.unlock();
+	TaskState wait() {
+		if (state.load() == TASK_PENDING) {
+			std::unique_lock<std::mutex> lock(mutex);
+			waiters++;
+			done.wait(lock, [this] { return state.load() != TASK_PENDING; });
+			waiters--;
+		}
+		return TaskState(state.load());
+	}
 
-			std::this_thread::sleep_for(std::chrono::milliseconds(task.processingTime));
+	TaskState result() const {
+		return TaskState(state.load());
+	}
 
-			{
-				std::lock_guard<std::mutex> coutLock(coutMutex);
-				std::cout << "		worker " << workerId << " completed task " << task.id
-					<< " after " << task.processingTime << " milliseconds\n";
-			}
-		}
+	// only meaningful once the result is in
+	long long finishedAt() const {
+		return completionTime;
 	}
+};
+
+class TaskFuture {
+private:
+	TaskCompletion* completion;
 
 public:
-	LoadBalancer(int numWorkers) : stop(false) {
-		for (int i = 0; i < numWorkers; ++i) {
-			workers.emplace_back(&LoadBalancer::workerFunction, this, i);
+	TaskFuture() : completion(nullptr) {}
+	// adopts a reference the caller already holds
+	explicit TaskFuture(TaskCompletion* taskCompletion) : completion(taskCompletion) {}
+	TaskFuture(const TaskFuture& other) : completion(other.completion) {
+		if (completion != nullptr) {
+			completion->addRef();
+		}
+	}
+	TaskFuture& operator=(TaskFuture other) {
+		std::swap(completion, other.completion);
+		return *this;
+	}
+	~TaskFuture() {
+		if (completion != nullptr) {
+			completion->release();
 		}
 	}
 
-	~LoadBalancer() {
-		stop = true;
-		condition.notify_all();
+	bool ready() const {
+		return completion == nullptr || completion->result() != TASK_PENDING;
+	}
 
-		for (auto& worker : workers) {
-			if (worker.joinable()) {
-				worker.join();
-			}
-		}
+	TaskState wait() const {
+		return completion == nullptr ? TASK_DONE : completion->wait();
 	}
 
-	void enqueueTask(const Task& task) {
-		std::lock_guard<std::mutex> lock(queueMutex);
-		taskQueue.push(task);
-		condition.notify_one();
+	long long completionTime() const {
+		return completion == nullptr ? 0 : completion->finishedAt();
 	}
 };
 
-void loadBalancing(int numWorkers, int numTasks, int& score);
+struct Task {
+	int id;
+	TaskKind kind;
+	int work;
+	int priority;
+	// absolute, in timestampNs() time, 0 for none
+	long long deadline;
+	long long enqueueTime;
+	long long dequeueTime;
+	long long completionTime;
+	// set by LoadBalancer::submit(), a plain pointer keeps Task trivially copyable for the lock-free queues
+	TaskCompletion* completion;
+	// a suspended coroutine to resume in place of kind and work, see LoadBalancer::spawn()
+	void* frame;
+
+	Task() : id(0), kind(TASK_SLEEP), work(0), priority(0), deadline(0), enqueueTime(0), dequeueTime(0), completionTime(0),
+		completion(nullptr), frame(nullptr) {}
+	Task(int taskId, int time) : id(taskId), kind(TASK_SLEEP), work(time), priority(0), deadline(0), enqueueTime(0), dequeueTime(0), completionTime(0),
+		completion(nullptr), frame(nullptr) {}
+	Task(int taskId, TaskKind taskKind, int taskWork) : id(taskId), kind(taskKind), work(taskWork), priority(0), deadline(0), enqueueTime(0),
+		dequeueTime(0), completionTime(0), completion(nullptr), frame(nullptr) {}
+};
 
-//main
-int main()
-{
-	bool reset = true;
-	while (reset) {
-		int totalScore = 0;
-		int paralelismScore = 0;
-		int maxThreadsScore = 0;
-		int loadBalancingScore = 0;
+#define WORKLOAD_SEED 42
+#define LOGNORMAL_SIGMA 1.0
+#define PARETO_ALPHA 1.5
+#define BIMODAL_LARGE_FRACTION 0.1
+#define BIMODAL_RATIO 10.0
+#define MAX_WORK_FACTOR 1000.0
 
-		system("cls");
-		cpuSpecs();
+// the periodic pattern is the original (i % workers + 1) * work staircase, the others have work as their mean
+enum ServiceDistribution { DIST_PERIODIC, DIST_UNIFORM, DIST_EXPONENTIAL, DIST_LOGNORMAL, DIST_PARETO, DIST_BIMODAL, DIST_COUNT };
+const char* serviceDistributionNames[DIST_COUNT] = { "periodic", "uniform", "exponential", "log-normal", "pareto", "bimodal" };
 
-		int testSelectKey = 0;
+struct WorkloadConfig {
+	TaskKind kind;
+	int work;
+	ServiceDistribution distribution;
+	unsigned int seed;
 
-		std::cout << "--------------------------------------------------------------\n";
-		std::cout << "Please select one:\n";
-		std::cout << "	to run all tests press 1\n";
-		std::cout << "	to run Paralelism Test press 2\n";
-		std::cout << "	to run Maximum Thread Test press 3\n";
-		std::cout << "	to run Load Balacing Test press 4\n";
-		std::cout << "input: ";
-		std::cin >> testSelectKey;
-		std::cout << "--------------------------------------------------------------\n";
-		while (!std::cin.good() || (testSelectKey != 1 && testSelectKey != 2 && testSelectKey != 3 && testSelectKey != 4)) {
-			std::cin.clear();
-			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-			system("cls");
-			cpuSpecsPrint();
-			std::cout << "--------------------------------------------------------------\n";
-			std::cout << "Please select one:\n";
-			std::cout << "	to run all tests press 1\n";
-			std::cout << "	to run Paralelism Test press 2\n";
-			std::cout << "	to run Maximum Thread Test press 3\n";
-			std::cout << "	to run Load Balacing Test press 4\n";
-			std::cout << "input: ";
-			std::cin >> testSelectKey;
-			std::cout << "--------------------------------------------------------------\n";
-		}
+	WorkloadConfig() : kind(TASK_SPIN), work(taskKindDefaultWork[TASK_SPIN]), distribution(DIST_PERIODIC), seed(WORKLOAD_SEED) {}
+};
 
-		int precision;
-		char nothing[256];
-		int numWorkers = 0;
-		int numTasks = 0;
+// draws task sizes for one producer, the same seed gives the same sequence on every run
+class WorkSampler {
+private:
+	WorkloadConfig workload;
+	int numWorkers;
+	int index;
+	std::mt19937 random;
+	std::uniform_real_distribution<double> unit;
 
-		switch (testSelectKey) {
-		case 1:
-			system("cls");
-			graphParalelism(5, paralelismScore);
-			totalScore += paralelismScore;
+public:
+	WorkSampler(const WorkloadConfig& config, int workers)
+		: workload(config), numWorkers(std::max(1, workers)), index(0), random(config.seed), unit(0.0, 1.0) {}
+
+	int next() {
+		double mean = workload.work;
+		double work;
+		switch (workload.distribution) {
+		case DIST_UNIFORM:
+			work = 2.0 * mean * unit(random);
+			break;
+		case DIST_EXPONENTIAL:
+			work = -mean * std::log(1.0 - unit(random));
+			break;
+		case DIST_LOGNORMAL:
+			work = std::lognormal_distribution<double>(std::log(mean) - LOGNORMAL_SIGMA * LOGNORMAL_SIGMA / 2, LOGNORMAL_SIGMA)(random);
+			break;
+		case DIST_PARETO:
+			// scale chosen so the mean is work, the variance is infinite
+			work = mean * (PARETO_ALPHA - 1) / PARETO_ALPHA / std::pow(1.0 - unit(random), 1.0 / PARETO_ALPHA);
+			break;
+		case DIST_BIMODAL: {
+			double small = mean / (1.0 - BIMODAL_LARGE_FRACTION + BIMODAL_LARGE_FRACTION * BIMODAL_RATIO);
+			work = unit(random) < BIMODAL_LARGE_FRACTION ? small * BIMODAL_RATIO : small;
+			break;
+		}
+		default:
+			work = (index % numWorkers + 1) * mean;
+			break;
+		}
+		index++;
+		// a single huge draw would stall the whole run
+		return int(std::min(work, mean * MAX_WORK_FACTOR));
+	}
+};
 
-			std::cout << "Press Enter to Continue";
-			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+#define CHASE_MAX_BYTES (32 * 1024 * 1024)
 
-			/*
-			std::cout << "\nWrite something and press enter to continue\n";
-			std::cin >> nothing;
-			std::cout << "\n";
-			*/
+// one Sattolo cycle read by every worker, built before the pools start so no task pays for the shuffle
+std::vector<unsigned int> chaseCycle;
 
-			do {
-				std::cin.clear();
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				system("cls");
-				std::cout << "Provide precision for calculating number pi (recommended 1000): ";
-				std::cin >> precision;
-				std::cout << "\n";
-			} while (!std::cin.good());
-			system("cls");
-			measureMaxThreads(1, precision, maxThreadsScore);
-			totalScore += maxThreadsScore;
+void prepareChase(const WorkloadConfig& workload) {
+	if (workload.kind != TASK_CHASE) {
+		return;
+	}
+	// as large as the biggest draw the sampler can make, a longer walk goes round the cycle again
+	double largest = std::min(workload.work * MAX_WORK_FACTOR, double(CHASE_MAX_BYTES));
+	size_t entries = std::max(size_t(2), size_t(largest) / sizeof(unsigned int));
+	if (chaseCycle.size() >= entries) {
+		return;
+	}
+	std::minstd_rand random(workload.seed);
+	chaseCycle.resize(entries);
+	for (size_t i = 0; i < entries; i++) {
+		chaseCycle[i] = (unsigned int)i;
+	}
+	// one cycle through every entry so the prefetcher cannot follow
+	for (size_t i = entries - 1; i > 0; i--) {
+		size_t j = random() % i;
+		std::swap(chaseCycle[i], chaseCycle[j]);
+	}
+}
 
-			std::cout << "Press Enter to Continue";
-			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+// every context adds its sink here when it goes, so the optimizer has to keep the task bodies
+std::atomic<unsigned long long> taskSink(0);
 
-			do {
-				std::cin.clear();
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				system("cls");
-				std::cout << "Provide inputs for number of workers and number of tasks:\n";
-				std::cout << "	number of workers: ";
-				std::cin >> numWorkers;
-			} while (!std::cin.good());
-			do {
-				std::cin.clear();
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				system("cls");
-				std::cout << "Provide inputs for number of workers and number of tasks:\n";
-				std::cout << "	number of workers: " << numWorkers << "\n";
-				std::cout << "	number of tasks: ";
-				std::cin >> numTasks;
-				std::cout << "\n";
-			} while (!std::cin.good());
-			
-			system("cls");
-			loadBalancing(numWorkers, numTasks, loadBalancingScore);
-			totalScore += loadBalancingScore;
+// scratch memory owned by one worker, reused by every task it runs
+struct TaskContext {
+	std::vector<long long> stream;
+	std::vector<char> encrypted;
+	long int keys[2];
+	unsigned long long sink;
 
-			std::cout << "Write something and Press Enter to Continue";
-			std::cin >> nothing;
-			break;
+	TaskContext() : sink(0) {
+		keys[0] = 0;
+		keys[1] = 0;
+	}
 
-		case 2:
-			system("cls");
-			graphParalelism(5, paralelismScore);
-			totalScore += paralelismScore;
+	~TaskContext() {
+		taskSink += sink;
+	}
+};
 
-			std::cout << "Write something and Press Enter to Continue";
-			std::cin >> nothing;
-			break;
-		
-		case 3:
-			system("cls");
-			do {
-				std::cin.clear();
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				system("cls");
-				std::cout << "Provide precision for calculating number pi (recommended 1000): ";
-				std::cin >> precision;
-				std::cout << "\n";
-			} while (!std::cin.good());
-			system("cls");
-			measureMaxThreads(0, precision, maxThreadsScore);
-			totalScore += maxThreadsScore;
+double spinIterationsPerCycle = 1.0;
 
-			std::cout << "Press Enter to Continue";
-			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-			break;
+unsigned long long spinLoop(long long iterations);
+void calibrateSpin();
+void runTask(const Task& task, TaskContext& context);
 
-		case 4:
-			do {
-				std::cin.clear();
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				system("cls");
-				std::cout << "Provide inputs for number of workers and number of tasks:\n";
-				std::cout << "	number of workers: ";
-				std::cin >> numWorkers;
-			} while (!std::cin.good());
-			do {
-				std::cin.clear();
-				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-				system("cls");
-				std::cout << "Provide inputs for number of workers and number of tasks:\n";
-				std::cout << "	number of workers: " << numWorkers << "\n";
-				std::cout << "	number of tasks: ";
-				std::cin >> numTasks;
-				std::cout << "\n";
-			} while (!std::cin.good());
+enum LogLevel { LOG_QUIET, LOG_THREAD, LOG_TASK, LOG_LEVEL_COUNT };
+const char* logLevelNames[LOG_LEVEL_COUNT] = { "quiet", "per-thread summaries", "every task" };
 
-			system("cls");
-			loadBalancing(numWorkers, numTasks, loadBalancingScore);
-			totalScore += loadBalancingScore;
+enum LogEvent { LOG_TASK_COMPLETED, LOG_THREAD_FINISHED };
 
-			std::cout << "Write something and Press Enter to Continue";
-			std::cin >> nothing;
-			break;
-			//std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-		}
+struct LogRecord {
+	long long timestamp;
+	LogEvent event;
+	int thread;
+	int id;
+	int kind;
+	int work;
+	float seconds;
+};
 
-		int resetSelectKey;
-		do {
-			system("cls");
-			std::cout << "--------------------------------------------------------------\n";
-			std::cout << "Total score performed: " << totalScore << "\n";
-			std::cout << "--------------------------------------------------------------\n";
-			std::cout << "Please select one:\n";
-			std::cout << "	to reset press 1\n";
-			std::cout << "	to end press 2\n";
-			std::cout << "input: ";
-			std::cin >> resetSelectKey;
-			std::cout << "--------------------------------------------------------------\n";
-		} while (!std::cin.good() || (resetSelectKey != 1 && resetSelectKey != 2));
-		if (resetSelectKey == 2) {
-			reset = false;
+// every thread appends binary records to its own buffer without locking,
+// the text is only produced by flush() once the writers have been joined
+class Logger {
+private:
+	std::mutex registryMutex;
+	std::vector<std::unique_ptr<std::vector<LogRecord> > > buffers;
+	std::atomic<int> generation;
+	int level;
+
+	std::vector<LogRecord>& localBuffer() {
+		// a flush frees every buffer, a thread notices through the generation and registers a new one
+		thread_local std::vector<LogRecord>* buffer = nullptr;
+		thread_local int bufferGeneration = -1;
+		int current = generation.load(std::memory_order_acquire);
+		if (buffer == nullptr || bufferGeneration != current) {
+			std::lock_guard<std::mutex> lock(registryMutex);
+			buffers.emplace_back(new std::vector<LogRecord>());
+			buffer = buffers.back().get();
+			bufferGeneration = current;
 		}
+		return *buffer;
 	}
 
-	/*
-	cpuSpecs();
+	void append(LogEvent event, int thread, int id, int kind, int work, float seconds) {
+		LogRecord record = { timestampNs(), event, thread, id, kind, work, seconds };
+		localBuffer().push_back(record);
+	}
 
-	graphParalelism(3, paralelismScore);
-	totalScore += paralelismScore;
+public:
+	Logger() : generation(0), level(LOG_TASK) {}
 
-	measureMaxThreads(120, 1000, maxThreadsScore);
-	totalScore += maxThreadsScore;
-	
+	void setLevel(int newLevel) {
+		level = newLevel;
+	}
+
+	bool enabled(LogLevel messageLevel) const {
+		return messageLevel <= level;
+	}
+
+	void taskCompleted(int worker, const Task& task) {
+		if (enabled(LOG_TASK)) {
+			append(LOG_TASK_COMPLETED, worker, task.id, task.kind, task.work, 0.0f);
+		}
+	}
+
+	void threadFinished(int thread, float seconds) {
+		if (enabled(LOG_THREAD)) {
+			append(LOG_THREAD_FINISHED, thread, 0, 0, 0, seconds);
+		}
+	}
+
+	void flush() {
+		std::lock_guard<std::mutex> lock(registryMutex);
+		std::vector<LogRecord> records;
+		for (auto& buffer : buffers) {
+			records.insert(records.end(), buffer->begin(), buffer->end());
+		}
+		buffers.clear();
+		generation++;
+
+		std::stable_sort(records.begin(), records.end(), [](const LogRecord& a, const LogRecord& b) {
+			return a.timestamp < b.timestamp;
+		});
+		for (const LogRecord& record : records) {
+			switch (record.event) {
+			case LOG_TASK_COMPLETED:
+				std::cout << "		worker " << record.thread << " completed " << taskKindNames[record.kind] << " task " << record.id
+					<< " of " << record.work << " " << taskKindUnits[record.kind] << "\n";
+				break;
+			case LOG_THREAD_FINISHED:
+				std::cout << "			thread " << record.thread << " finished in " << record.seconds << "\n";
+				break;
+			}
+		}
+	}
+};
+
+Logger logger;
+
+enum SchedulerBackend { GLOBAL_QUEUE, WORK_STEALING, LOCK_FREE_QUEUE, SHARDED_ROUND_ROBIN, SHARDED_TWO_CHOICES, NUMA_HIERARCHICAL, BACKEND_COUNT };
+const char* schedulerBackendNames[BACKEND_COUNT] = { "global queue", "work stealing", "lock-free queue", "sharded round-robin", "sharded two choices",
+	"NUMA hierarchical" };
+
+enum ParkingMode { PARK_CONDITION, PARK_EVENTCOUNT };
+
+enum PopSource { POP_NONE, POP_LOCAL, POP_STOLEN };
+
+// what a worker does between finding its queue empty and parking
+enum IdleStrategy { IDLE_BLOCK, IDLE_SPIN_THEN_BLOCK, IDLE_SPIN_YIELD, IDLE_ADAPTIVE, IDLE_STRATEGY_COUNT };
+const char* idleStrategyNames[IDLE_STRATEGY_COUNT] = { "block", "spin then block", "spin with pause and yield", "adaptive spin budget" };
+
+#define IDLE_SPINS 2000
+#define IDLE_MIN_SPINS 64
+#define IDLE_MAX_SPINS 65536
+#define IDLE_YIELD_INTERVAL 64
+
+class TaskScheduler {
+protected:
+	// only ever incremented while the lock it counts is held
+	long long lockAcquisitions;
+
+public:
+	TaskScheduler() : lockAcquisitions(0) {}
+	virtual ~TaskScheduler() {}
+
+	// workerId is the pushing worker, or -1 for a producer outside the pool
+	virtual void push(const Task& task, int workerId) = 0;
+	virtual PopSource tryPop(int workerId, Task& task) = 0;
+
+	virtual void pushBulk(const Task* tasks, int count, int workerId) {
+		for (int i = 0; i < count; ++i) {
+			push(tasks[i], workerId);
+		}
+	}
+
+	// fills up to maxCount tasks, all from the same source
+	virtual int tryPopBatch(int workerId, Task* tasks, int maxCount, PopSource& source) {
+		source = tryPop(workerId, tasks[0]);
+		return source == POP_NONE ? 0 : 1;
+	}
+
+	// queued tasks, read from the backend's own counters, so only approximate while workers run
+	virtual long long size() const = 0;
+
+	// whether workerId could pop something right now, a parked worker sleeps until this turns true
+	virtual bool hasWork(int workerId) const {
+		return size() > 0;
+	}
+
+	virtual long long locks() const {
+		return lockAcquisitions;
+	}
+
+	// mean gap between the longest and the shortest per-worker queue, 0 with a single queue
+	virtual double imbalance() const {
+		return 0.0;
+	}
+
+	// steals that stayed within a NUMA node
+	virtual long long localSteals() const {
+		return 0;
+	}
+
+	// steals that crossed a NUMA node boundary
+	virtual long long remoteSteals() const {
+		return 0;
+	}
+
+	// the pool reports which workers run, so a backend whose workers only pop their own queue never feeds a stopped one.
+	// returns how many tasks it moved off a stopped worker's queue
+	virtual int setActive(int workerId, bool active) {
+		return 0;
+	}
+
+	// fills the processor group and cores a worker should be pinned to, false leaves it to the OS
+	virtual bool affinity(int workerId, GROUP_AFFINITY& affinity) const {
+		return false;
+	}
+};
+
+class GlobalQueueScheduler : public TaskScheduler {
+private:
+	std::queue<Task> taskQueue;
+	std::mutex queueMutex;
+	// written under queueMutex, read without it
+	std::atomic<long long> length;
+
+public:
+	GlobalQueueScheduler() : length(0) {}
+
+	void push(const Task& task, int workerId) override {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		lockAcquisitions++;
+		taskQueue.push(task);
+		length++;
+	}
+
+	PopSource tryPop(int workerId, Task& task) override {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		lockAcquisitions++;
+		if (taskQueue.empty()) {
+			return POP_NONE;
+		}
+		task = taskQueue.front();
+		taskQueue.pop();
+		length--;
+		return POP_LOCAL;
+	}
+
+	void pushBulk(const Task* tasks, int count, int workerId) override {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		lockAcquisitions++;
+		for (int i = 0; i < count; ++i) {
+			taskQueue.push(tasks[i]);
+		}
+		length += count;
+	}
+
+	int tryPopBatch(int workerId, Task* tasks, int maxCount, PopSource& source) override {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		lockAcquisitions++;
+		int count = 0;
+		while (count < maxCount && !taskQueue.empty()) {
+			tasks[count++] = taskQueue.front();
+			taskQueue.pop();
+		}
+		length -= count;
+		source = count > 0 ? POP_LOCAL : POP_NONE;
+		return count;
+	}
+
+	long long size() const override {
+		return length.load();
+	}
+};
+
+// Chase-Lev deque, the owner works on the bottom and thieves take from the top
+class WorkStealingDeque {
+private:
+	static const int TASK_WORDS = (sizeof(Task) + sizeof(unsigned long long) - 1) / sizeof(unsigned long long);
+
+	// a thief may read a slot while the owner's next push overwrites it, the words are atomic so that is a torn copy
+	// instead of a data race, and the failed exchange throws the copy away
+	struct Slot {
+		std::atomic<unsigned long long> words[TASK_WORDS];
+	};
+
+	std::unique_ptr<Slot[]> buffer;
+	long long mask;
+	std::atomic<long long> top;
+	std::atomic<long long> bottom;
+
+	void store(long long index, const Task& task) {
+		unsigned long long words[TASK_WORDS] = {};
+		memcpy(words, &task, sizeof(Task));
+		Slot& slot = buffer[index & mask];
+		for (int i = 0; i < TASK_WORDS; ++i) {
+			slot.words[i].store(words[i], std::memory_order_relaxed);
+		}
+	}
+
+	void load(long long index, Task& task) const {
+		unsigned long long words[TASK_WORDS];
+		const Slot& slot = buffer[index & mask];
+		for (int i = 0; i < TASK_WORDS; ++i) {
+			words[i] = slot.words[i].load(std::memory_order_relaxed);
+		}
+		memcpy(&task, words, sizeof(Task));
+	}
+
+public:
+	WorkStealingDeque(long long capacity) : buffer(new Slot[capacity]), mask(capacity - 1), top(0), bottom(0) {}
+
+	bool push(const Task& task) {
+		long long b = bottom.load(std::memory_order_relaxed);
+		long long t = top.load(std::memory_order_acquire);
+		if (b - t > mask) {
+			return false;
+		}
+		store(b, task);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	bool pop(Task& task) {
+		long long b = bottom.load(std::memory_order_relaxed) - 1;
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long t = top.load(std::memory_order_relaxed);
+		if (t > b) {
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return false;
+		}
+		load(b, task);
+		if (t == b) {
+			// last element, race the thieves for it
+			bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+			bottom.store(b + 1, std::memory_order_relaxed);
+			return won;
+		}
+		return true;
+	}
+
+	bool steal(Task& task) {
+		long long t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		long long b = bottom.load(std::memory_order_acquire);
+		if (t >= b) {
+			return false;
+		}
+		load(t, task);
+		return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+	}
+
+	// the owner lowers bottom for a moment while it pops, so this can be one short
+	long long size() const {
+		long long t = top.load(std::memory_order_acquire);
+		long long b = bottom.load(std::memory_order_acquire);
+		return b > t ? b - t : 0;
+	}
+};
+
+class WorkStealingScheduler : public TaskScheduler {
+private:
+	std::vector<std::unique_ptr<WorkStealingDeque>> deques;
+	std::vector<std::minstd_rand> victims;
+	std::queue<Task> injection;
+	std::mutex injectionMutex;
+	std::atomic<long long> injected;
+
+public:
+	WorkStealingScheduler(int numWorkers) : injected(0) {
+		for (int i = 0; i < numWorkers; ++i) {
+			deques.emplace_back(new WorkStealingDeque(DEQUE_CAPACITY));
+			victims.emplace_back(i + 1);
+		}
+	}
+
+	void push(const Task& task, int workerId) override {
+		if (workerId >= 0 && deques[workerId]->push(task)) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(injectionMutex);
+		lockAcquisitions++;
+		injection.push(task);
+		injected++;
+	}
+
+	void pushBulk(const Task* tasks, int count, int workerId) override {
+		if (workerId >= 0) {
+			TaskScheduler::pushBulk(tasks, count, workerId);
+			return;
+		}
+		std::lock_guard<std::mutex> lock(injectionMutex);
+		lockAcquisitions++;
+		for (int i = 0; i < count; ++i) {
+			injection.push(tasks[i]);
+		}
+		injected += count;
+	}
+
+	PopSource tryPop(int workerId, Task& task) override {
+		if (deques[workerId]->pop(task)) {
+			return POP_LOCAL;
+		}
+
+		// take one task from the injection queue and a batch more for the thieves
+		if (injected.load() > 0) {
+			std::lock_guard<std::mutex> lock(injectionMutex);
+			lockAcquisitions++;
+			if (!injection.empty()) {
+				task = injection.front();
+				injection.pop();
+				injected--;
+				for (int i = 1; i < INJECTION_BATCH && !injection.empty(); ++i) {
+					if (!deques[workerId]->push(injection.front())) {
+						break;
+					}
+					injection.pop();
+					injected--;
+				}
+				return POP_LOCAL;
+			}
+		}
+
+		int count = (int)deques.size();
+		int start = victims[workerId]() % count;
+		for (int i = 0; i < count; ++i) {
+			int victim = (start + i) % count;
+			if (victim != workerId && deques[victim]->steal(task)) {
+				return POP_STOLEN;
+			}
+		}
+		return POP_NONE;
+	}
+
+	long long size() const override {
+		long long total = injected.load();
+		for (auto& deque : deques) {
+			total += deque->size();
+		}
+		return total;
+	}
+};
+
+// Vyukov bounded queue, every cell carries a sequence number telling whose turn it is
+class LockFreeQueueScheduler : public TaskScheduler {
+private:
+	struct Cell {
+		std::atomic<long long> sequence;
+		Task task;
+	};
+
+	std::unique_ptr<Cell[]> cells;
+	long long mask;
+	char padding0[64];
+	std::atomic<long long> enqueuePos;
+	char padding1[64];
+	std::atomic<long long> dequeuePos;
+	char padding2[64];
+	// tasks that found the ring full, drained by the workers once the ring is empty
+	std::queue<Task> overflow;
+	std::mutex overflowMutex;
+	std::atomic<long long> overflowLength;
+
+	bool tryPush(const Task& task) {
+		Cell* cell;
+		long long pos = enqueuePos.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &cells[pos & mask];
+			long long diff = cell->sequence.load(std::memory_order_acquire) - pos;
+			if (diff == 0) {
+				if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = enqueuePos.load(std::memory_order_relaxed);
+			}
+		}
+		cell->task = task;
+		cell->sequence.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool tryDequeue(Task& task) {
+		Cell* cell;
+		long long pos = dequeuePos.load(std::memory_order_relaxed);
+		while (true) {
+			cell = &cells[pos & mask];
+			long long diff = cell->sequence.load(std::memory_order_acquire) - (pos + 1);
+			if (diff == 0) {
+				if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+					break;
+				}
+			}
+			else if (diff < 0) {
+				return false;
+			}
+			else {
+				pos = dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+		task = cell->task;
+		cell->sequence.store(pos + mask + 1, std::memory_order_release);
+		return true;
+	}
+
+	int popOverflow(Task* tasks, int maxCount) {
+		if (overflowLength.load() == 0) {
+			return 0;
+		}
+		std::lock_guard<std::mutex> lock(overflowMutex);
+		lockAcquisitions++;
+		int count = 0;
+		while (count < maxCount && !overflow.empty()) {
+			tasks[count++] = overflow.front();
+			overflow.pop();
+		}
+		overflowLength -= count;
+		return count;
+	}
+
+public:
+	LockFreeQueueScheduler(long long capacity) : cells(new Cell[capacity]), mask(capacity - 1), enqueuePos(0), dequeuePos(0), overflowLength(0) {
+		for (long long i = 0; i < capacity; ++i) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	// waiting for a free cell could livelock when the workers themselves push successors into a full ring,
+	// so a full ring spills into a locked queue, and so does every push behind it until the spill is gone
+	void push(const Task& task, int workerId) override {
+		if (overflowLength.load() == 0 && tryPush(task)) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(overflowMutex);
+		lockAcquisitions++;
+		overflow.push(task);
+		overflowLength++;
+	}
+
+	PopSource tryPop(int workerId, Task& task) override {
+		if (tryDequeue(task)) {
+			return POP_LOCAL;
+		}
+		return popOverflow(&task, 1) > 0 ? POP_LOCAL : POP_NONE;
+	}
+
+	int tryPopBatch(int workerId, Task* tasks, int maxCount, PopSource& source) override {
+		int count = 0;
+		while (count < maxCount && tryDequeue(tasks[count])) {
+			count++;
+		}
+		if (count < maxCount) {
+			count += popOverflow(tasks + count, maxCount - count);
+		}
+		source = count > 0 ? POP_LOCAL : POP_NONE;
+		return count;
+	}
+
+	// a claimed cell counts before its task is published, dequeuePos is read first so this never goes negative
+	long long size() const override {
+		long long head = dequeuePos.load();
+		long long tail = enqueuePos.load();
+		return tail - head + overflowLength.load();
+	}
+};
+
+// one locked queue per worker, producers pick the shard either in turn or as the shorter of two random ones,
+// a worker only ever pops its own shard so the dispatch alone decides the balance
+class ShardedScheduler : public TaskScheduler {
+private:
+	struct Shard {
+		std::mutex mutex;
+		std::queue<Task> tasks;
+		std::atomic<long long> length;
+		// changed under mutex, read without it to choose a shard
+		std::atomic<bool> active;
+		long long locks;
+		char padding[64];
+
+		Shard() : length(0), active(false), locks(0) {}
+	};
+
+	std::vector<std::unique_ptr<Shard>> shards;
+	bool twoChoices;
+	std::atomic<long long> spreadSum;
+	std::atomic<long long> spreadSamples;
+
+	// the pool keeps at least one worker running, so there is always an active shard to find
+	int chooseShard() {
+		int count = (int)shards.size();
+		if (!twoChoices) {
+			// every producer keeps its own turn, a shared counter would be written on every push
+			thread_local long long nextShard = 0;
+			int shard;
+			do {
+				shard = int(nextShard++ % count);
+			} while (!shards[shard]->active.load());
+			return shard;
+		}
+		thread_local std::minstd_rand random((unsigned int)std::hash<std::thread::id>()(std::this_thread::get_id()));
+		int first;
+		int second;
+		do {
+			first = random() % count;
+		} while (!shards[first]->active.load());
+		do {
+			second = random() % count;
+		} while (!shards[second]->active.load());
+		return shards[second]->length.load() < shards[first]->length.load() ? second : first;
+	}
+
+	bool popFrom(int shardId, Task& task) {
+		Shard& shard = *shards[shardId];
+		if (shard.length.load() == 0) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.locks++;
+		if (shard.tasks.empty()) {
+			return false;
+		}
+		task = shard.tasks.front();
+		shard.tasks.pop();
+		shard.length--;
+		return true;
+	}
+
+	void sampleSpread() {
+		thread_local long long pushes = 0;
+		if (pushes++ % SHARD_SPREAD_INTERVAL != 0) {
+			return;
+		}
+		long long shortest = std::numeric_limits<long long>::max();
+		long long longest = 0;
+		for (auto& shard : shards) {
+			if (!shard->active.load()) {
+				continue;
+			}
+			long long length = shard->length.load();
+			shortest = std::min(shortest, length);
+			longest = std::max(longest, length);
+		}
+		spreadSum += longest - shortest;
+		spreadSamples++;
+	}
+
+public:
+	ShardedScheduler(int numWorkers, bool useTwoChoices)
+		: twoChoices(useTwoChoices), spreadSum(0), spreadSamples(0) {
+		for (int i = 0; i < numWorkers; ++i) {
+			shards.emplace_back(new Shard());
+		}
+	}
+
+	void push(const Task& task, int workerId) override {
+		// work a worker creates for itself stays on its own shard
+		int target = workerId;
+		while (true) {
+			Shard& shard = *shards[target >= 0 ? target : chooseShard()];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			// the shard's worker stopped, its own shard stays closed, so the retry goes through the dispatch
+			if (!shard.active.load()) {
+				target = -1;
+				continue;
+			}
+			shard.locks++;
+			shard.tasks.push(task);
+			shard.length++;
+			break;
+		}
+		sampleSpread();
+	}
+
+	// a stopped worker's leftovers go back through the dispatch, a push that raced the stop finds the shard closed
+	int setActive(int workerId, bool active) override {
+		std::vector<Task> moved;
+		{
+			Shard& shard = *shards[workerId];
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.locks++;
+			shard.active = active;
+			while (!active && !shard.tasks.empty()) {
+				moved.push_back(shard.tasks.front());
+				shard.tasks.pop();
+			}
+			shard.length -= (long long)moved.size();
+		}
+		for (const Task& task : moved) {
+			push(task, -1);
+		}
+		return (int)moved.size();
+	}
+
+	PopSource tryPop(int workerId, Task& task) override {
+		return popFrom(workerId, task) ? POP_LOCAL : POP_NONE;
+	}
+
+	// a worker parks on its own shard, work queued elsewhere is not its to take
+	bool hasWork(int workerId) const override {
+		return shards[workerId]->length.load() > 0;
+	}
+
+	long long locks() const override {
+		long long total = 0;
+		for (auto& shard : shards) {
+			total += shard->locks;
+		}
+		return total;
+	}
+
+	double imbalance() const override {
+		long long samples = spreadSamples.load();
+		return samples == 0 ? 0.0 : double(spreadSum.load()) / samples;
+	}
+
+	long long size() const override {
+		long long total = 0;
+		for (auto& shard : shards) {
+			total += shard->length.load();
+		}
+		return total;
+	}
+};
+
+// the processor group and mask of every node that has processors, a single all-zero entry when there is no NUMA information
+std::vector<GROUP_AFFINITY> numaNodeAffinities();
+
+// per-worker shards grouped by node, an idle worker steals from its own node before it crosses to another one
+class NumaScheduler : public TaskScheduler {
+private:
+	struct Shard {
+		std::mutex mutex;
+		std::queue<Task> tasks;
+		std::atomic<long long> length;
+		long long locks;
+		char padding[64];
+
+		Shard() : length(0), locks(0) {}
+	};
+
+	std::vector<GROUP_AFFINITY> nodeAffinities;
+	std::vector<std::unique_ptr<Shard>> shards;
+	std::vector<int> workerNode;
+	std::vector<std::vector<int>> nodeWorkers;
+	std::atomic<long long> nodeSteals;
+	std::atomic<long long> crossSteals;
+
+	bool popFrom(int shardId, Task& task) {
+		Shard& shard = *shards[shardId];
+		if (shard.length.load() == 0) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.locks++;
+		if (shard.tasks.empty()) {
+			return false;
+		}
+		task = shard.tasks.front();
+		shard.tasks.pop();
+		shard.length--;
+		return true;
+	}
+
+	bool stealFrom(const std::vector<int>& victims, int workerId, Task& task) {
+		int count = (int)victims.size();
+		int start = workerId % count;
+		for (int i = 0; i < count; ++i) {
+			int victim = victims[(start + i) % count];
+			if (victim != workerId && popFrom(victim, task)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// processor numbers only count within a group, so a node is matched on the group first
+	int currentNode() const {
+		PROCESSOR_NUMBER processor;
+		GetCurrentProcessorNumberEx(&processor);
+		for (int node = 0; node < nodes(); ++node) {
+			const GROUP_AFFINITY& affinity = nodeAffinities[node];
+			if (affinity.Group == processor.Group && (affinity.Mask & (KAFFINITY(1) << processor.Number)) != 0) {
+				return node;
+			}
+		}
+		return 0;
+	}
+
+	// a producer fills the shards of the node it is running on, so its tasks start out node-local
+	int producerShard() {
+		const std::vector<int>& local = nodeWorkers[nodes() > 1 ? currentNode() : 0];
+		thread_local long long nextShard = 0;
+		return local[nextShard++ % local.size()];
+	}
+
+public:
+	NumaScheduler(int numWorkers) : nodeAffinities(numaNodeAffinities()), workerNode(numWorkers), nodeWorkers(nodeAffinities.size()),
+		nodeSteals(0), crossSteals(0) {
+		// workers go round-robin over the nodes, with fewer workers than nodes the last nodes stay empty
+		int nodes = (int)std::min(nodeAffinities.size(), size_t(numWorkers));
+		nodeAffinities.resize(nodes);
+		nodeWorkers.resize(nodes);
+		for (int i = 0; i < numWorkers; ++i) {
+			shards.emplace_back(new Shard());
+			workerNode[i] = i % nodes;
+			nodeWorkers[i % nodes].push_back(i);
+		}
+	}
+
+	int nodes() const {
+		return (int)nodeAffinities.size();
+	}
+
+	void push(const Task& task, int workerId) override {
+		Shard& shard = *shards[workerId >= 0 ? workerId : producerShard()];
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		shard.locks++;
+		shard.tasks.push(task);
+		shard.length++;
+	}
+
+	PopSource tryPop(int workerId, Task& task) override {
+		if (popFrom(workerId, task)) {
+			return POP_LOCAL;
+		}
+		int node = workerNode[workerId];
+		if (stealFrom(nodeWorkers[node], workerId, task)) {
+			nodeSteals++;
+			return POP_STOLEN;
+		}
+		// the whole node is dry, only now pull Task payloads over the interconnect
+		int count = nodes();
+		for (int i = 1; i < count; ++i) {
+			if (stealFrom(nodeWorkers[(node + i) % count], workerId, task)) {
+				crossSteals++;
+				return POP_STOLEN;
+			}
+		}
+		return POP_NONE;
+	}
+
+	long long locks() const override {
+		long long total = 0;
+		for (auto& shard : shards) {
+			total += shard->locks;
+		}
+		return total;
+	}
+
+	long long localSteals() const override {
+		return nodeSteals.load();
+	}
+
+	long long remoteSteals() const override {
+		return crossSteals.load();
+	}
+
+	long long size() const override {
+		long long total = 0;
+		for (auto& shard : shards) {
+			total += shard->length.load();
+		}
+		return total;
+	}
+
+	// a single node is left unpinned, there is nothing to keep local
+	bool affinity(int workerId, GROUP_AFFINITY& affinity) const override {
+		if (nodes() <= 1) {
+			return false;
+		}
+		affinity = nodeAffinities[workerNode[workerId]];
+		return true;
+	}
+};
+
+// the FIFO mode leaves the choice to the backend, the others replace it with a single ordered queue
+enum SchedulingMode { SCHEDULE_FIFO, SCHEDULE_STRICT_PRIORITY, SCHEDULE_WEIGHTED_FAIR, SCHEDULE_EDF, SCHEDULE_MODE_COUNT };
+const char* schedulingModeNames[SCHEDULE_MODE_COUNT] = { "FIFO", "strict priority", "weighted fair", "earliest deadline first" };
+
+#define FAIR_STRIDE 1000000
+
+class PriorityScheduler : public TaskScheduler {
+private:
+	struct Deadline {
+		long long deadline;
+		long long sequence;
+		Task task;
+
+		// std::priority_queue keeps the largest on top
+		bool operator<(const Deadline& other) const {
+			return deadline != other.deadline ? deadline > other.deadline : sequence > other.sequence;
+		}
+	};
+
+	SchedulingMode mode;
+	std::mutex queueMutex;
+	std::queue<Task> classes[PRIORITY_CLASSES];
+	// stride scheduling, the class with the lowest pass runs next and advances by FAIR_STRIDE / weight
+	long long pass[PRIORITY_CLASSES];
+	long long virtualTime;
+	std::priority_queue<Deadline> deadlines;
+	long long sequence;
+	// written under queueMutex, read without it
+	std::atomic<long long> length;
+
+	int pickClass() {
+		int picked = -1;
+		for (int c = 0; c < PRIORITY_CLASSES; ++c) {
+			if (classes[c].empty()) {
+				continue;
+			}
+			if (mode == SCHEDULE_STRICT_PRIORITY) {
+				return c;
+			}
+			if (picked < 0 || pass[c] < pass[picked]) {
+				picked = c;
+			}
+		}
+		return picked;
+	}
+
+	void pushLocked(const Task& task) {
+		if (mode == SCHEDULE_EDF) {
+			// tasks without a deadline go after every task that has one, in arrival order
+			Deadline entry = { task.deadline > 0 ? task.deadline : std::numeric_limits<long long>::max(), sequence++, task };
+			deadlines.push(entry);
+			return;
+		}
+		int c = std::min(std::max(task.priority, 0), PRIORITY_CLASSES - 1);
+		if (classes[c].empty()) {
+			// an idle class must not bank the turns it missed
+			pass[c] = std::max(pass[c], virtualTime);
+		}
+		classes[c].push(task);
+	}
+
+	bool popLocked(Task& task) {
+		if (mode == SCHEDULE_EDF) {
+			if (deadlines.empty()) {
+				return false;
+			}
+			task = deadlines.top().task;
+			deadlines.pop();
+			return true;
+		}
+		int c = pickClass();
+		if (c < 0) {
+			return false;
+		}
+		task = classes[c].front();
+		classes[c].pop();
+		virtualTime = pass[c];
+		pass[c] += FAIR_STRIDE / priorityClassWeights[c];
+		return true;
+	}
+
+public:
+	PriorityScheduler(SchedulingMode schedulingMode) : mode(schedulingMode), virtualTime(0), sequence(0), length(0) {
+		for (int c = 0; c < PRIORITY_CLASSES; ++c) {
+			pass[c] = 0;
+		}
+	}
+
+	void push(const Task& task, int workerId) override {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		lockAcquisitions++;
+		pushLocked(task);
+		length++;
+	}
+
+	PopSource tryPop(int workerId, Task& task) override {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		lockAcquisitions++;
+		if (!popLocked(task)) {
+			return POP_NONE;
+		}
+		length--;
+		return POP_LOCAL;
+	}
+
+	void pushBulk(const Task* tasks, int count, int workerId) override {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		lockAcquisitions++;
+		for (int i = 0; i < count; ++i) {
+			pushLocked(tasks[i]);
+		}
+		length += count;
+	}
+
+	// a batch takes the next maxCount tasks in scheduling order, so a large batch blurs the order across workers
+	int tryPopBatch(int workerId, Task* tasks, int maxCount, PopSource& source) override {
+		std::lock_guard<std::mutex> lock(queueMutex);
+		lockAcquisitions++;
+		int count = 0;
+		while (count < maxCount && popLocked(tasks[count])) {
+			count++;
+		}
+		length -= count;
+		source = count > 0 ? POP_LOCAL : POP_NONE;
+		return count;
+	}
+
+	long long size() const override {
+		return length.load();
+	}
+};
+
+TaskScheduler* createScheduler(SchedulerBackend backend, int numWorkers);
+
+// futex style parking, waiters sleep on the epoch word until a notify bumps it
+class EventCount {
+private:
+	std::atomic<unsigned int> epoch;
+	std::atomic<int> waiters;
+
+public:
+	EventCount() : epoch(0), waiters(0) {}
+
+	unsigned int prepareWait() {
+		waiters++;
+		return epoch.load();
+	}
+
+	void cancelWait() {
+		waiters--;
+	}
+
+	void commitWait(unsigned int key) {
+		while (epoch.load() == key) {
+			WaitOnAddress(&epoch, &key, sizeof(key), INFINITE);
+		}
+		waiters--;
+	}
+
+	// false when the time ran out without a notification
+	bool commitWait(unsigned int key, int timeoutMs) {
+		auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+		while (epoch.load() == key) {
+			auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (remaining <= 0) {
+				waiters--;
+				return false;
+			}
+			WaitOnAddress(&epoch, &key, sizeof(key), DWORD(remaining));
+		}
+		waiters--;
+		return true;
+	}
+
+	void notifyOne() {
+		if (waiters.load() > 0) {
+			epoch++;
+			WakeByAddressSingle(&epoch);
+		}
+	}
+
+	void notifyAll() {
+		epoch++;
+		WakeByAddressAll(&epoch);
+	}
+};
+
+// one per worker and padded apart, a wake touches only the slot of the worker it goes to
+struct ParkingSlot {
+	EventCount events;
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::atomic<bool> parked;
+	// only ever incremented while mutex is held
+	long long locks;
+	char padding[64];
+
+	ParkingSlot() : parked(false), locks(0) {}
+};
+
+// log-linear buckets in nanoseconds: exact below 2^bits, then 2^(bits-1) buckets per power of two
+// so every recorded value is kept within 1/64 of its true size up to about an hour
+class LatencyHistogram {
+private:
+	std::vector<long long> counts;
+	long long total;
+	long long sum;
+	long long maxValue;
+
+	static int highestBit(unsigned long long value) {
+		unsigned long index;
+		if (_BitScanReverse(&index, (unsigned long)(value >> 32))) {
+			return int(index) + 32;
+		}
+		_BitScanReverse(&index, (unsigned long)value);
+		return int(index);
+	}
+
+	static size_t bucketIndex(long long value) {
+		const long long subBuckets = 1LL << HISTOGRAM_SUB_BUCKET_BITS;
+		if (value < subBuckets) {
+			return size_t(value);
+		}
+		int shift = highestBit(value) - (HISTOGRAM_SUB_BUCKET_BITS - 1);
+		return size_t(subBuckets + (shift - 1) * (subBuckets / 2) + ((value >> shift) - subBuckets / 2));
+	}
+
+	static long long bucketValue(size_t index) {
+		const long long subBuckets = 1LL << HISTOGRAM_SUB_BUCKET_BITS;
+		if ((long long)index < subBuckets) {
+			return (long long)index;
+		}
+		long long shift = ((long long)index - subBuckets) / (subBuckets / 2) + 1;
+		long long sub = ((long long)index - subBuckets) % (subBuckets / 2) + subBuckets / 2;
+		// report the middle of the bucket
+		return (sub << shift) + (1LL << (shift - 1));
+	}
+
+public:
+	LatencyHistogram() : counts(bucketIndex((1LL << HISTOGRAM_MAX_BITS) - 1) + 1), total(0), sum(0), maxValue(0) {}
+
+	void record(long long value) {
+		value = std::max(0LL, std::min(value, (1LL << HISTOGRAM_MAX_BITS) - 1));
+		counts[bucketIndex(value)]++;
+		total++;
+		sum += value;
+		maxValue = std::max(maxValue, value);
+	}
+
+	void merge(const LatencyHistogram& other) {
+		for (size_t i = 0; i < counts.size(); i++) {
+			counts[i] += other.counts[i];
+		}
+		total += other.total;
+		sum += other.sum;
+		maxValue = std::max(maxValue, other.maxValue);
+	}
+
+	long long percentile(double p) const {
+		if (total == 0) {
+			return 0;
+		}
+		long long rank = std::max(1LL, (long long)std::ceil(p * total));
+		long long seen = 0;
+		for (size_t i = 0; i < counts.size(); i++) {
+			seen += counts[i];
+			if (seen >= rank) {
+				return std::min(bucketValue(i), maxValue);
+			}
+		}
+		return maxValue;
+	}
+
+	long long count() const {
+		return total;
+	}
+
+	double mean() const {
+		return total == 0 ? 0.0 : double(sum) / total;
+	}
+};
+
+// nodes are added in topological order, every edge goes from a lower to a higher index
+class TaskGraph {
+private:
+	struct Node {
+		TaskKind kind;
+		int work;
+		int predecessors;
+		std::vector<int> successors;
+	};
+
+	std::vector<Node> nodes;
+
+public:
+	int addNode(TaskKind kind, int work) {
+		Node node;
+		node.kind = kind;
+		node.work = work;
+		node.predecessors = 0;
+		nodes.push_back(node);
+		return (int)nodes.size() - 1;
+	}
+
+	void addEdge(int from, int to) {
+		nodes[from].successors.push_back(to);
+		nodes[to].predecessors++;
+	}
+
+	int size() const {
+		return (int)nodes.size();
+	}
+
+	Task task(int node) const {
+		return Task(node, nodes[node].kind, nodes[node].work);
+	}
+
+	int predecessors(int node) const {
+		return nodes[node].predecessors;
+	}
+
+	const std::vector<int>& successors(int node) const {
+		return nodes[node].successors;
+	}
+
+	// longest path through the graph when every node costs cost[node]
+	long long criticalPath(const std::vector<long long>& cost) const {
+		std::vector<long long> start(nodes.size(), 0);
+		long long longest = 0;
+		for (size_t i = 0; i < nodes.size(); ++i) {
+			long long finish = start[i] + cost[i];
+			longest = std::max(longest, finish);
+			for (int successor : nodes[i].successors) {
+				start[successor] = std::max(start[successor], finish);
+			}
+		}
+		return longest;
+	}
+};
+
+enum GraphShape { GRAPH_FORK_JOIN, GRAPH_WAVEFRONT, GRAPH_RANDOM, GRAPH_SHAPE_COUNT };
+const char* graphShapeNames[GRAPH_SHAPE_COUNT] = { "fork-join tree", "wavefront", "random DAG" };
+
+void forkJoinGraph(TaskGraph& graph, int depth, int fanout, const WorkloadConfig& workload);
+void wavefrontGraph(TaskGraph& graph, int side, const WorkloadConfig& workload);
+void randomGraph(TaskGraph& graph, int numNodes, int maxPredecessors, unsigned int seed, const WorkloadConfig& workload);
+void buildGraph(TaskGraph& graph, GraphShape shape, int numTasks, const WorkloadConfig& workload);
+
+// each worker records into its own histograms, nothing is shared until they are merged after the join
+struct WorkerStats {
+	long long tasks;
+	long long steals;
+	LatencyHistogram wait;
+	LatencyHistogram service;
+	LatencyHistogram sojourn;
+	// time from the decision to start this worker to its first task, elastic pools only
+	LatencyHistogram scaleUp;
+	LatencyHistogram classSojourn[PRIORITY_CLASSES];
+	long long classTasks[PRIORITY_CLASSES];
+	long long deadlineTasks[PRIORITY_CLASSES];
+	long long deadlineMisses[PRIORITY_CLASSES];
+	// idle periods that ended with work found while spinning, and ones that went on to park
+	long long spinHits;
+	long long parks;
+	double cpuSeconds;
+	// popped after shutdown(SHUTDOWN_CANCEL) and never run
+	long long cancelled;
+	// TSC cycles split three ways: running tasks, inside scheduler calls, and looking for work or parked.
+	// for the mutex backends the scheduler share is mostly waiting on their locks
+	unsigned long long busyCycles;
+	unsigned long long schedulerCycles;
+	unsigned long long idleCycles;
+	// last queue wait this worker saw, the elastic controller reads it to decide on growing
+	std::atomic<long long> recentWait;
+	// raised before a pop and lowered once a pop comes back empty, waitIdle() reads it
+	std::atomic<bool> busy;
+	// when this worker last finished or cancelled a task, in timestampNs() time
+	std::atomic<long long> lastCompletion;
+	char padding[64];
+
+	WorkerStats() : tasks(0), steals(0), recentWait(0), busy(false), lastCompletion(0), spinHits(0), parks(0), cpuSeconds(0.0), cancelled(0),
+		busyCycles(0), schedulerCycles(0), idleCycles(0) {
+		for (int c = 0; c < PRIORITY_CLASSES; ++c) {
+			classTasks[c] = deadlineTasks[c] = deadlineMisses[c] = 0;
+		}
+	}
+};
+
+struct PoolEvent {
+	long long time;
+	int workers;
+};
+
+// how many parked workers a bulk enqueue wakes
+enum WakePolicy { WAKE_PER_TASK, WAKE_K, WAKE_ALL, WAKE_POLICY_COUNT };
+const char* wakePolicyNames[WAKE_POLICY_COUNT] = { "notify one per task", "notify k", "notify all" };
+
+// what a producer does when the queue is full
+enum BackpressurePolicy { BP_BLOCK, BP_SPIN_THEN_BLOCK, BP_DROP_NEWEST, BP_CALLER_RUNS, BP_POLICY_COUNT };
+const char* backpressurePolicyNames[BP_POLICY_COUNT] = { "block", "spin then block", "drop newest", "caller runs" };
+
+struct BackpressureStats {
+	long long highWater;
+	long long stallNs;
+	long long dropped;
+	long long callerRuns;
+};
+
+struct LoadBalancerConfig {
+	SchedulerBackend backend;
+	SchedulingMode scheduling;
+	ParkingMode parking;
+	int dequeueBatch;
+	WakePolicy wake;
+	// an elastic pool runs between minWorkers and the constructor's numWorkers threads
+	bool elastic;
+	int minWorkers;
+	int scaleUpDepth;
+	long long scaleUpWaitNs;
+	int idleTimeoutMs;
+	// at most capacity queued tasks, 0 leaves the queue unbounded
+	long long capacity;
+	BackpressurePolicy backpressure;
+	IdleStrategy idle;
+	// the fixed spin count, and the starting budget of the adaptive strategy
+	int idleSpins;
+
+	LoadBalancerConfig() : backend(GLOBAL_QUEUE), scheduling(SCHEDULE_FIFO), parking(PARK_CONDITION), dequeueBatch(1), wake(WAKE_PER_TASK),
+		elastic(false), minWorkers(1), scaleUpDepth(ELASTIC_SCALE_UP_DEPTH), scaleUpWaitNs(ELASTIC_SCALE_UP_WAIT_NS), idleTimeoutMs(ELASTIC_IDLE_MS),
+		capacity(0), backpressure(BP_BLOCK), idle(IDLE_BLOCK), idleSpins(IDLE_SPINS) {}
+};
+
+LoadBalancerConfig defaultConfig(SchedulerBackend backend);
+
+// drain runs everything already queued, cancel resolves the queued tasks' futures without running them
+enum ShutdownMode { SHUTDOWN_DRAIN, SHUTDOWN_CANCEL };
+
+std::atomic<long long> asyncFrameBytes(0);
+std::atomic<long long> asyncFrames(0);
+
+// a fire-and-forget coroutine, it starts suspended and frees its frame when it returns
+struct AsyncTask {
+	struct promise_type {
+		AsyncTask get_return_object() {
+			return AsyncTask{ std::coroutine_handle<promise_type>::from_promise(*this) };
+		}
+		std::suspend_always initial_suspend() noexcept {
+			return {};
+		}
+		std::suspend_never final_suspend() noexcept {
+			return {};
+		}
+		void return_void() {}
+		void unhandled_exception() {
+			std::terminate();
+		}
+
+		// counts the frames, the memory per task comparison reads it
+		static void* operator new(std::size_t size) {
+			asyncFrameBytes += size;
+			asyncFrames++;
+			return ::operator new(size);
+		}
+		static void operator delete(void* frame) {
+			::operator delete(frame);
+		}
+	};
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+// one arrival, packed so a trace costs 20 bytes a task on disk
+#pragma pack(push, 1)
+struct TraceRecord {
+	// since the trace began
+	long long arrival;
+	int work;
+	// relative to the arrival, 0 for none
+	int deadlineUs;
+	unsigned char kind;
+	unsigned char priority;
+	unsigned short producer;
+};
+
+struct TraceHeader {
+	char magic[4];
+	unsigned int version;
+	unsigned long long count;
+};
+#pragma pack(pop)
+
+// the arrival stream of a LoadBalancer run, producers are numbered in the order they first enqueue
+class TaskTrace {
+private:
+	std::mutex traceMutex;
+	std::vector<TraceRecord> records;
+	std::vector<std::thread::id> producerIds;
+	long long origin;
+
+	unsigned short producerIndex() {
+		std::thread::id self = std::this_thread::get_id();
+		for (size_t i = 0; i < producerIds.size(); ++i) {
+			if (producerIds[i] == self) {
+				return (unsigned short)i;
+			}
+		}
+		producerIds.push_back(self);
+		return (unsigned short)(producerIds.size() - 1);
+	}
+
+public:
+	TaskTrace() : origin(0) {}
+
+	void begin(long long start) {
+		std::lock_guard<std::mutex> lock(traceMutex);
+		records.clear();
+		producerIds.clear();
+		origin = start;
+	}
+
+	void append(const Task& task, long long arrivalTime) {
+		std::lock_guard<std::mutex> lock(traceMutex);
+		TraceRecord record;
+		record.arrival = arrivalTime - origin;
+		record.work = task.work;
+		record.deadlineUs = task.deadline > 0 ? int((task.deadline - arrivalTime) / 1000) : 0;
+		record.kind = (unsigned char)task.kind;
+		record.priority = (unsigned char)task.priority;
+		record.producer = producerIndex();
+		records.push_back(record);
+	}
+
+	// read it only once the recording run has finished
+	const std::vector<TraceRecord>& tasks() const {
+		return records;
+	}
+
+	int producers() const {
+		int count = 0;
+		for (const TraceRecord& record : records) {
+			count = std::max(count, record.producer + 1);
+		}
+		return count;
+	}
+
+	bool save(const char* path) const {
+		std::ofstream file(path, std::ofstream::out | std::ofstream::binary | std::ofstream::trunc);
+		TraceHeader header = { { 'L', 'B', 'T', 'R' }, TRACE_VERSION, records.size() };
+		file.write((const char*)&header, sizeof(header));
+		file.write((const char*)records.data(), records.size() * sizeof(TraceRecord));
+		return file.good();
+	}
+
+	bool load(const char* path) {
+		std::ifstream file(path, std::ifstream::in | std::ifstream::binary);
+		TraceHeader header;
+		if (!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, "LBTR", 4) != 0 || header.version != TRACE_VERSION) {
+			return false;
+		}
+		records.resize((size_t)header.count);
+		file.read((char*)records.data(), records.size() * sizeof(TraceRecord));
+		return file.good();
+	}
+};
+
+class LoadBalancer {
+private:
+	std::vector<std::thread> workers;
+	std::unique_ptr<TaskScheduler> scheduler;
+	std::vector<WorkerStats> workerStats;
+	ParkingMode parking;
+	int dequeueBatch;
+	WakePolicy wake;
+	IdleStrategy idle;
+	int idleSpins;
+	std::unique_ptr<ParkingSlot[]> parkingSlots;
+	std::atomic<bool> stop;
+	std::atomic<int> submitters;
+	const TaskGraph* graph;
+	std::unique_ptr<std::atomic<int>[]> dependencies;
+	std::vector<long long> graphService;
+	std::atomic<long long> outstanding;
+	bool elastic;
+	int minWorkers;
+	int scaleUpDepth;
+	long long scaleUpWaitNs;
+	int idleTimeoutMs;
+	std::mutex elasticMutex;
+	std::vector<bool> running;
+	std::vector<long long> spawnTimes;
+	std::vector<PoolEvent> poolEvents;
+	std::atomic<int> activeWorkers;
+	std::atomic<long long> lastScaleCheck;
+	long long capacity;
+	BackpressurePolicy backpressure;
+	std::mutex spaceMutex;
+	std::condition_variable spaceAvailable;
+	std::atomic<int> blockedProducers;
+	std::atomic<long long> highWater;
+	std::atomic<long long> stallNs;
+	std::atomic<long long> droppedTasks;
+	std::atomic<long long> callerRunTasks;
+	std::mutex callerMutex;
+	LatencyHistogram callerSojourn;
+	std::atomic<bool> cancelled;
+	std::mutex idleMutex;
+	std::condition_variable idleCondition;
+	std::atomic<int> idleWaiters;
+	TaskTrace* trace;
+
+	void workerFunction(int workerId) {
+		WorkerStats& stats = workerStats[workerId];
+		TaskContext context;
+		std::vector<Task> batch(dequeueBatch);
+		PopSource source;
+		bool started = false;
+		bool busy = false;
+		int spinBudget = idleSpins;
+		double cpuStart = GetThreadCpuSeconds();
+		unsigned long long loopStart = __rdtsc();
+		unsigned long long busyBefore = stats.busyCycles;
+		unsigned long long schedulerBefore = stats.schedulerCycles;
+		while (true) {
+			// a task is always either queued or held by a busy worker, the flag only changes on the way in and out of idle
+			if (!busy) {
+				busy = true;
+				stats.busy.store(true);
+			}
+			unsigned long long popStart = __rdtsc();
+			int count = scheduler->tryPopBatch(workerId, batch.data(), dequeueBatch, source);
+			stats.schedulerCycles += __rdtsc() - popStart;
+			if (count == 0) {
+				busy = false;
+				stats.busy.store(false);
+				// the same handshake as parking, waitIdle() raises idleWaiters before it looks at the workers
+				if (idleWaiters.load() > 0) {
+					std::lock_guard<std::mutex> lock(idleMutex);
+					idleCondition.notify_all();
+				}
+				if (drained() && !scheduler->hasWork(workerId)) {
+					break;
+				}
+				if (idleSpin(workerId, spinBudget)) {
+					stats.spinHits++;
+					continue;
+				}
+				stats.parks++;
+				if (!park(workerId) && retire(workerId)) {
+					break;
+				}
+				continue;
+			}
+			if (source == POP_STOLEN) {
+				stats.steals += count;
+			}
+			// the same handshake as parking, producers raise blockedProducers before they look at the size
+			if (blockedProducers.load() > 0) {
+				std::lock_guard<std::mutex> lock(spaceMutex);
+				spaceAvailable.notify_all();
+			}
+			if (!started) {
+				started = true;
+				if (spawnTimes[workerId] > 0) {
+					stats.scaleUp.record(timestampNs() - spawnTimes[workerId]);
+				}
+			}
+
+			for (int i = 0; i < count; ++i) {
+				// a task waiting behind its batch mates is still waiting, so the clock starts when it runs
+				Task& task = batch[i];
+				if (cancelled.load(std::memory_order_relaxed)) {
+					stats.cancelled++;
+					if (graph != nullptr) {
+						releaseSuccessors(task, workerId);
+					}
+					finish(task, TASK_CANCELLED, timestampNs(), stats);
+					continue;
+				}
+				task.dequeueTime = timestampNs();
+				unsigned long long runStart = __rdtsc();
+
+				runTask(task, context);
+
+				stats.busyCycles += __rdtsc() - runStart;
+				task.completionTime = timestampNs();
+				stats.wait.record(task.dequeueTime - task.enqueueTime);
+				stats.service.record(task.completionTime - task.dequeueTime);
+				stats.sojourn.record(task.completionTime - task.enqueueTime);
+				stats.recentWait.store(task.dequeueTime - task.enqueueTime, std::memory_order_relaxed);
+				stats.tasks++;
+				int c = std::min(std::max(task.priority, 0), PRIORITY_CLASSES - 1);
+				stats.classSojourn[c].record(task.completionTime - task.enqueueTime);
+				stats.classTasks[c]++;
+				if (task.deadline > 0) {
+					stats.deadlineTasks[c]++;
+					stats.deadlineMisses[c] += task.completionTime > task.deadline;
+				}
+
+				logger.taskCompleted(workerId, task);
+
+				if (graph != nullptr) {
+					graphService[task.id] = task.completionTime - task.dequeueTime;
+					releaseSuccessors(task, workerId);
+				}
+				finish(task, TASK_DONE, task.completionTime, stats);
+			}
+		}
+		stats.cpuSeconds += GetThreadCpuSeconds() - cpuStart;
+		stats.idleCycles += (__rdtsc() - loopStart) - (stats.busyCycles - busyBefore) - (stats.schedulerCycles - schedulerBefore);
+	}
+
+	void finish(const Task& task, TaskState result, long long time, WorkerStats& stats) {
+		if (task.completion != nullptr) {
+			task.completion->complete(result, time);
+		}
+		stats.lastCompletion.store(time, std::memory_order_relaxed);
+	}
+
+	bool spinFor(int workerId, int spins) {
+		for (int i = 0; i < spins; ++i) {
+			if (scheduler->hasWork(workerId) || drained()) {
+				return true;
+			}
+			_mm_pause();
+		}
+		return false;
+	}
+
+	// true when work showed up before the worker would have to park
+	bool idleSpin(int workerId, int& budget) {
+		switch (idle) {
+		case IDLE_SPIN_THEN_BLOCK:
+			return spinFor(workerId, idleSpins);
+
+		case IDLE_SPIN_YIELD:
+			// never parks, the core stays busy for as long as the pool is up
+			while (!spinFor(workerId, IDLE_YIELD_INTERVAL)) {
+				std::this_thread::yield();
+			}
+			return true;
+
+		case IDLE_ADAPTIVE: {
+			// a spin that pays off earns a longer one next time, a wasted one halves the budget
+			bool found = spinFor(workerId, budget);
+			budget = found ? std::min(budget * 2, IDLE_MAX_SPINS) : std::max(budget / 2, IDLE_MIN_SPINS);
+			return found;
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	// ready successors go to the finishing worker's own queue, where it is likely to pick them up next
+	void releaseSuccessors(const Task& task, int workerId) {
+		for (int successor : graph->successors(task.id)) {
+			if (--dependencies[successor] == 0) {
+				Task ready = graph->task(successor);
+				ready.enqueueTime = timestampNs();
+				scheduler->push(ready, workerId);
+				wakeOne();
+			}
+		}
+		// the workers only leave once the whole graph is done, wake the parked ones to let them go
+		if (--outstanding == 0 && stop) {
+			wakeAll();
+		}
+	}
+
+	// a submit() that got past the stop check may still be pushing, the workers wait for it
+	bool drained() {
+		return stop && outstanding.load() == 0 && submitters.load() == 0;
+	}
+
+	// false when an elastic worker stayed idle for the whole timeout
+	bool park(int workerId) {
+		// parked is raised before the worker looks for work and wakers look at it after pushing,
+		// with a full fence on both sides either the worker sees the task or the waker sees the worker
+		ParkingSlot& slot = parkingSlots[workerId];
+		if (parking == PARK_EVENTCOUNT) {
+			unsigned int key = slot.events.prepareWait();
+			slot.parked.store(true);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (scheduler->hasWork(workerId) || drained()) {
+				slot.parked.store(false);
+				slot.events.cancelWait();
+				return true;
+			}
+			bool woken = true;
+			if (elastic) {
+				woken = slot.events.commitWait(key, idleTimeoutMs);
+			}
+			else {
+				slot.events.commitWait(key);
+			}
+			slot.parked.store(false);
+			return woken;
+		}
+
+		std::unique_lock<std::mutex> lock(slot.mutex);
+		slot.locks++;
+		slot.parked.store(true);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		auto ready = [this, &slot, workerId] { return !slot.parked.load() || scheduler->hasWork(workerId) || drained(); };
+		bool woken = true;
+		if (elastic) {
+			woken = slot.condition.wait_for(lock, std::chrono::milliseconds(idleTimeoutMs), ready);
+		}
+		else {
+			slot.condition.wait(lock, ready);
+		}
+		slot.parked.store(false);
+		return woken;
+	}
+
+	// the waker that takes the parked flag down owns the notify, so a worker is never woken twice for one task
+	bool unpark(int workerId) {
+		ParkingSlot& slot = parkingSlots[workerId];
+		if (!slot.parked.load() || !slot.parked.exchange(false)) {
+			return false;
+		}
+		if (parking == PARK_EVENTCOUNT) {
+			slot.events.notifyOne();
+		}
+		else {
+			std::lock_guard<std::mutex> lock(slot.mutex);
+			slot.locks++;
+			slot.condition.notify_one();
+		}
+		return true;
+	}
+
+	// called under elasticMutex
+	void startWorker(int workerId, long long spawnTime) {
+		if (workers[workerId].joinable()) {
+			// a retired thread that has already left its loop
+			workers[workerId].join();
+		}
+		running[workerId] = true;
+		scheduler->setActive(workerId, true);
+		spawnTimes[workerId] = spawnTime;
+		activeWorkers++;
+		PoolEvent event = { timestampNs(), activeWorkers.load() };
+		poolEvents.push_back(event);
+		workers[workerId] = std::thread(&LoadBalancer::workerFunction, this, workerId);
+		GROUP_AFFINITY affinity = {};
+		if (scheduler->affinity(workerId, affinity)) {
+			SetThreadGroupAffinity((HANDLE)workers[workerId].native_handle(), &affinity, nullptr);
+		}
+	}
+
+	// true when the task should be queued, false when it was dropped or run by the producer itself
+	bool admit(const Task& task) {
+		if (capacity <= 0 || scheduler->size() < capacity) {
+			return true;
+		}
+
+		switch (backpressure) {
+		case BP_DROP_NEWEST:
+			droppedTasks++;
+			if (task.completion != nullptr) {
+				task.completion->complete(TASK_CANCELLED, timestampNs());
+			}
+			// a dropped graph node counts as cancelled, its successors and shutdown() must not wait on it
+			if (graph != nullptr) {
+				releaseSuccessors(task, -1);
+			}
+			return false;
+
+		case BP_CALLER_RUNS: {
+			thread_local TaskContext context;
+			Task own = task;
+			own.dequeueTime = timestampNs();
+			runTask(own, context);
+			own.completionTime = timestampNs();
+			callerRunTasks++;
+			if (own.completion != nullptr) {
+				own.completion->complete(TASK_DONE, own.completionTime);
+			}
+			if (graph != nullptr) {
+				graphService[own.id] = own.completionTime - own.dequeueTime;
+				releaseSuccessors(own, -1);
+			}
+			std::lock_guard<std::mutex> lock(callerMutex);
+			callerSojourn.record(own.completionTime - own.enqueueTime);
+			return false;
+		}
+
+		default:
+			break;
+		}
+
+		// the capacity is soft, every producer that passes the check at once gets its task in
+		long long start = timestampNs();
+		if (backpressure == BP_SPIN_THEN_BLOCK) {
+			for (int i = 0; i < BACKPRESSURE_SPINS && scheduler->size() >= capacity; ++i) {
+				_mm_pause();
+			}
+		}
+		if (scheduler->size() >= capacity) {
+			std::unique_lock<std::mutex> lock(spaceMutex);
+			blockedProducers++;
+			spaceAvailable.wait(lock, [this] { return scheduler->size() < capacity; });
+			blockedProducers--;
+		}
+		stallNs += timestampNs() - start;
+		return true;
+	}
+
+	// only a bounded queue pays for it, an unbounded run that wants the mark sets the largest capacity
+	void trackHighWater() {
+		long long depth = scheduler->size();
+		long long seen = highWater.load();
+		while (depth > seen && !highWater.compare_exchange_weak(seen, depth)) {
+		}
+	}
+
+	bool retire(int workerId) {
+		if (!elastic || stop || scheduler->hasWork(workerId)) {
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(elasticMutex);
+		if (stop || activeWorkers.load() <= minWorkers) {
+			return false;
+		}
+		running[workerId] = false;
+		activeWorkers--;
+		PoolEvent event = { timestampNs(), activeWorkers.load() };
+		poolEvents.push_back(event);
+		wakeMany(scheduler->setActive(workerId, false));
+		return true;
+	}
+
+	// producers check at most once per interval whether the backlog calls for another worker
+	void maybeGrow() {
+		if (!elastic || activeWorkers.load() >= (int)workers.size()) {
+			return;
+		}
+		long long now = timestampNs();
+		long long last = lastScaleCheck.load();
+		if (now - last < ELASTIC_CHECK_NS || !lastScaleCheck.compare_exchange_strong(last, now)) {
+			return;
+		}
+		long long depth = scheduler->size();
+		if (depth == 0) {
+			return;
+		}
+		long long wait = 0;
+		for (auto& stats : workerStats) {
+			wait = std::max(wait, stats.recentWait.load(std::memory_order_relaxed));
+		}
+		if (depth <= (long long)scaleUpDepth * activeWorkers.load() && wait <= scaleUpWaitNs) {
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(elasticMutex);
+		// shutdown() sets stop before it takes the lock, so no thread starts after it collected them
+		if (stop) {
+			return;
+		}
+		for (int i = 0; i < (int)workers.size(); ++i) {
+			if (!running[i]) {
+				startWorker(i, now);
+				break;
+			}
+		}
+	}
+
+	void wakeOne() {
+		wakeMany(1);
+	}
+
+	// wakes up to count parked workers that have something to pop, each waker starts where its last scan stopped
+	void wakeMany(int count) {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		thread_local int cursor = 0;
+		int size = (int)workers.size();
+		for (int i = 0; i < size && count > 0; ++i) {
+			int workerId = (cursor + i) % size;
+			if (parkingSlots[workerId].parked.load() && scheduler->hasWork(workerId) && unpark(workerId)) {
+				cursor = workerId + 1;
+				count--;
+			}
+		}
+	}
+
+	// for shutdown and the end of a graph, when the workers have to wake up to leave
+	void wakeAll() {
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		for (int i = 0; i < (int)workers.size(); ++i) {
+			unpark(i);
+		}
+	}
+
+	// the queue is read before the workers, a task popped in between has already raised its worker's busy flag
+	bool poolIdle() const {
+		if (scheduler->size() > 0) {
+			return false;
+		}
+		for (auto& stats : workerStats) {
+			if (stats.busy.load()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void pushBatch(const std::vector<Task>& queued) {
+		int count = (int)queued.size();
+		if (count == 0) {
+			return;
+		}
+		scheduler->pushBulk(queued.data(), count, -1);
+		if (capacity > 0) {
+			trackHighWater();
+		}
+
+		switch (wake) {
+		case WAKE_ALL:
+			wakeMany((int)workers.size());
+			break;
+		case WAKE_K:
+			// one worker for every dequeue batch the tasks fill
+			wakeMany((count + dequeueBatch - 1) / dequeueBatch);
+			break;
+		default:
+			for (int i = 0; i < count; ++i) {
+				wakeOne();
+			}
+			break;
+		}
+	}
+
+public:
+	LoadBalancer(int numWorkers, const LoadBalancerConfig& config = LoadBalancerConfig())
+		: workers(numWorkers), scheduler(config.scheduling == SCHEDULE_FIFO ? createScheduler(config.backend, numWorkers) : new PriorityScheduler(config.scheduling)), workerStats(numWorkers), parking(config.parking),
+		dequeueBatch(std::max(1, std::min(config.dequeueBatch, MAX_BATCH))), wake(config.wake), idle(config.idle), idleSpins(std::max(1, config.idleSpins)), parkingSlots(new ParkingSlot[numWorkers]), stop(false), submitters(0),
+		graph(nullptr), outstanding(0), elastic(config.elastic), minWorkers(std::max(1, std::min(config.minWorkers, numWorkers))),
+		scaleUpDepth(config.scaleUpDepth), scaleUpWaitNs(config.scaleUpWaitNs), idleTimeoutMs(config.idleTimeoutMs),
+		running(numWorkers, false), spawnTimes(numWorkers, 0), activeWorkers(0), lastScaleCheck(0),
+		capacity(config.capacity), backpressure(config.backpressure), blockedProducers(0), highWater(0), stallNs(0),
+		droppedTasks(0), callerRunTasks(0), cancelled(false), idleWaiters(0),
+		trace(nullptr) {
+		std::lock_guard<std::mutex> lock(elasticMutex);
+		int initial = elastic ? minWorkers : numWorkers;
+		for (int i = 0; i < initial; ++i) {
+			startWorker(i, 0);
+		}
+	}
+
+	~LoadBalancer() {
+		shutdown();
+	}
+
+	// lets the workers empty the queue, running or cancelling what is left, and joins them
+	void shutdown(ShutdownMode mode = SHUTDOWN_DRAIN) {
+		if (mode == SHUTDOWN_CANCEL) {
+			cancelled = true;
+		}
+		stop = true;
+		// every submit() from here on sees stop, the ones already past the check finish their push first
+		while (submitters.load() > 0) {
+			std::this_thread::yield();
+		}
+		wakeAll();
+
+		// the threads are taken out under elasticMutex and joined outside it, a worker may still need the lock to retire
+		std::vector<std::thread> exiting;
+		{
+			std::lock_guard<std::mutex> lock(elasticMutex);
+			for (auto& worker : workers) {
+				if (worker.joinable()) {
+					exiting.push_back(std::move(worker));
+				}
+			}
+		}
+		for (auto& worker : exiting) {
+			worker.join();
+		}
+	}
+
+	void enqueueTask(const Task& task) {
+		enqueueTaskAt(task, timestampNs());
+	}
+
+	// after shutdown() nothing runs it any more, so the future comes back already cancelled
+	TaskFuture submit(const Task& task) {
+		Task queued = task;
+		queued.completion = new TaskCompletion();
+		TaskFuture future(queued.completion);
+		// raised before stop is read, so shutdown() and the exiting workers either see this submitter or it sees stop
+		submitters++;
+		if (stop) {
+			submitters--;
+			queued.completion->complete(TASK_CANCELLED, timestampNs());
+			return future;
+		}
+		enqueueTask(queued);
+		submitters--;
+		return future;
+	}
+
+	// blocks until every task enqueued so far has finished, the pool stays up for the next round
+	void waitIdle() {
+		if (poolIdle()) {
+			return;
+		}
+		std::unique_lock<std::mutex> lock(idleMutex);
+		idleWaiters++;
+		idleCondition.wait(lock, [this] { return poolIdle(); });
+		idleWaiters--;
+	}
+
+	// when the most recent task finished, in timestampNs() time
+	long long lastCompletionTime() const {
+		long long latest = 0;
+		for (auto& stats : workerStats) {
+			latest = std::max(latest, stats.lastCompletion.load(std::memory_order_relaxed));
+		}
+		return latest;
+	}
+
+	// every producer enqueue from now on lands in taskTrace, set it before the producers start
+	void recordTrace(TaskTrace* taskTrace) {
+		trace = taskTrace;
+		if (trace != nullptr) {
+			trace->begin(timestampNs());
+		}
+	}
+
+	// arrivalTime is when the task was due, so a late producer still counts against the latency
+	void enqueueTaskAt(const Task& task, long long arrivalTime) {
+		Task queued = task;
+		queued.enqueueTime = arrivalTime;
+		// the trace keeps the offered stream, including what backpressure turns away
+		if (trace != nullptr) {
+			trace->append(queued, arrivalTime);
+		}
+		if (!admit(queued)) {
+			return;
+		}
+		scheduler->push(queued, -1);
+		if (capacity > 0) {
+			trackHighWater();
+		}
+		wakeOne();
+		maybeGrow();
+	}
+
+	// takes a vector, an array or a slice of either
+	void enqueueBulk(std::span<const Task> tasks) {
+		std::vector<Task> queued;
+		queued.reserve(tasks.size());
+		long long now = timestampNs();
+		for (Task task : tasks) {
+			task.enqueueTime = now;
+			if (trace != nullptr) {
+				trace->append(task, now);
+			}
+			// the tasks collected so far count against the bound, and they go out before the producer could block on it
+			if (capacity > 0 && !queued.empty() && scheduler->size() + (long long)queued.size() >= capacity) {
+				pushBatch(queued);
+				queued.clear();
+			}
+			if (admit(task)) {
+				queued.push_back(task);
+			}
+		}
+		pushBatch(queued);
+		maybeGrow();
+	}
+
+	// queues the coroutine's first step, later steps come back through resumeLater()
+	void spawn(AsyncTask task) {
+		resumeLater(task.handle);
+	}
+
+	void resumeLater(std::coroutine_handle<> handle) {
+		Task resume;
+		resume.frame = handle.address();
+		enqueueTask(resume);
+	}
+
+	// starts every node without predecessors, call it once on an idle balancer and keep the graph alive until shutdown()
+	void runGraph(const TaskGraph& taskGraph) {
+		int size = taskGraph.size();
+		graph = &taskGraph;
+		dependencies.reset(new std::atomic<int>[size]);
+		graphService.assign(size, 0);
+		std::vector<Task> roots;
+		for (int i = 0; i < size; ++i) {
+			dependencies[i] = taskGraph.predecessors(i);
+			if (taskGraph.predecessors(i) == 0) {
+				roots.push_back(taskGraph.task(i));
+			}
+		}
+		outstanding += size;
+		enqueueBulk(roots);
+	}
+
+	// every change of the elastic pool size, read it after shutdown()
+	const std::vector<PoolEvent>& getPoolEvents() const {
+		return poolEvents;
+	}
+
+	// measured service time of every graph node, read it after shutdown()
+	const std::vector<long long>& getGraphService() const {
+		return graphService;
+	}
+
+	double queueImbalance() const {
+		return scheduler->imbalance();
+	}
+
+	long long nodeLocalSteals() const {
+		return scheduler->localSteals();
+	}
+
+	long long crossNodeSteals() const {
+		return scheduler->remoteSteals();
+	}
+
+	long long queueDepth() const {
+		return scheduler->size();
+	}
+
+	BackpressureStats getBackpressureStats() const {
+		BackpressureStats stats = { highWater.load(), stallNs.load(), droppedTasks.load(), callerRunTasks.load() };
+		return stats;
+	}
+
+	// tasks the producers ran themselves under the caller-runs policy, read it after shutdown()
+	const LatencyHistogram& getCallerSojourn() const {
+		return callerSojourn;
+	}
+
+	// scheduler and parking locks taken so far, read it after shutdown()
+	long long lockAcquisitions() const {
+		long long total = scheduler->locks();
+		for (int i = 0; i < (int)workers.size(); ++i) {
+			total += parkingSlots[i].locks;
+		}
+		return total;
+	}
+
+	const std::vector<WorkerStats>& getWorkerStats() const {
+		return workerStats;
+	}
+};
+
+// hashed timer wheel with one slot per tick, a timer more than a turn out stays in its slot until its turn comes
+class TimerWheel {
+private:
+	struct Timer {
+		long long due;
+		std::coroutine_handle<> handle;
+	};
+
+	LoadBalancer& pool;
+	std::vector<std::vector<Timer> > slots;
+	std::mutex wheelMutex;
+	long long start;
+	// the next tick the ticker has to go through
+	long long nextTick;
+	// ticker wake-ups and the time of the last one, for the tick the OS actually delivers
+	std::atomic<long long> turns;
+	std::atomic<long long> lastTurn;
+	std::atomic<bool> stop;
+	std::thread ticker;
+
+	void run() {
+		std::vector<Task> ready;
+		while (!stop) {
+			std::this_thread::sleep_for(std::chrono::nanoseconds(TIMER_TICK_NS));
+			long long now = timestampNs();
+			turns++;
+			lastTurn = now;
+			long long tick = (now - start) / TIMER_TICK_NS;
+			ready.clear();
+			{
+				std::lock_guard<std::mutex> lock(wheelMutex);
+				for (; nextTick <= tick; nextTick++) {
+					std::vector<Timer>& slot = slots[nextTick % TIMER_WHEEL_SLOTS];
+					for (size_t i = 0; i < slot.size();) {
+						if (slot[i].due <= now) {
+							Task resume;
+							resume.frame = slot[i].handle.address();
+							ready.push_back(resume);
+							slot[i] = slot.back();
+							slot.pop_back();
+						}
+						else {
+							i++;
+						}
+					}
+				}
+			}
+			// a whole tick's worth of timers goes to the pool in one push
+			if (!ready.empty()) {
+				pool.enqueueBulk(ready);
+			}
+		}
+	}
+
+public:
+	TimerWheel(LoadBalancer& loadBalancer)
+		: pool(loadBalancer), slots(TIMER_WHEEL_SLOTS), start(timestampNs()), nextTick(0), turns(0), lastTurn(0), stop(false) {
+		ticker = std::thread(&TimerWheel::run, this);
+	}
+
+	// every timer must have fired before the wheel goes, the coroutines waiting on it would never resume
+	~TimerWheel() {
+		stop = true;
+		ticker.join();
+	}
+
+	// mean time between ticker wake-ups, sleep_for rounds TIMER_TICK_NS up to the OS timer resolution
+	double tickNs() const {
+		long long count = turns.load();
+		return count == 0 ? 0.0 : double(lastTurn.load() - start) / count;
+	}
+
+	void add(long long due, std::coroutine_handle<> handle) {
+		std::lock_guard<std::mutex> lock(wheelMutex);
+		long long tick = std::max((due - start + TIMER_TICK_NS - 1) / TIMER_TICK_NS, nextTick);
+		Timer timer = { due, handle };
+		slots[tick % TIMER_WHEEL_SLOTS].push_back(timer);
+	}
+
+	struct Awaiter {
+		TimerWheel& wheel;
+		long long due;
+
+		bool await_ready() const {
+			return due <= timestampNs();
+		}
+		void await_suspend(std::coroutine_handle<> handle) {
+			wheel.add(due, handle);
+		}
+		void await_resume() const {}
+	};
+
+	// co_await wheel.sleepUntil(due) parks the coroutine without holding a thread
+	Awaiter sleepUntil(long long due) {
+		return Awaiter{ *this, due };
+	}
+};
+
+struct DepthSample {
+	// since the sampler started
+	long long time;
+	long long depth;
+};
+
+// reads the queue depth of a running pool at a fixed interval from its own thread
+class QueueDepthSampler {
+private:
+	const LoadBalancer& pool;
+	long long interval;
+	long long start;
+	std::vector<DepthSample> samples;
+	std::atomic<bool> stop;
+	std::thread sampler;
+
+	void run() {
+		// the schedule is absolute, a late wake-up does not push the later samples back
+		long long next = start;
+		while (!stop) {
+			next += interval;
+			long long ahead = next - timestampNs();
+			if (ahead > 0) {
+				std::this_thread::sleep_for(std::chrono::nanoseconds(ahead));
+			}
+			DepthSample sample = { timestampNs() - start, pool.queueDepth() };
+			samples.push_back(sample);
+		}
+	}
+
+public:
+	QueueDepthSampler(const LoadBalancer& loadBalancer, long long intervalNs = DEPTH_SAMPLE_NS)
+		: pool(loadBalancer), interval(intervalNs), start(timestampNs()), stop(false) {
+		sampler = std::thread(&QueueDepthSampler::run, this);
+	}
+
+	~QueueDepthSampler() {
+		finish();
+	}
+
+	// stops the sampler, the samples are only safe to read after this
+	const std::vector<DepthSample>& finish() {
+		if (sampler.joinable()) {
+			stop = true;
+			sampler.join();
+		}
+		return samples;
+	}
+};
+
+struct WorkerUsage {
+	long long tasks;
+	long long steals;
+	unsigned long long busyCycles;
+	unsigned long long schedulerCycles;
+	unsigned long long idleCycles;
+};
+
+struct LoadBalancingResult {
+	float time;
+	long long tasks;
+	long long steals;
+	long long localSteals;
+	long long remoteSteals;
+	double imbalance;
+	LatencyHistogram wait;
+	LatencyHistogram service;
+	LatencyHistogram sojourn;
+	std::vector<WorkerUsage> workers;
+	std::vector<DepthSample> depth;
+};
+
+void printLatency(const char* name, const LatencyHistogram& histogram);
+void printUtilization(const char* name, const LoadBalancingResult& result);
+LoadBalancingResult runLoadBalancing(int numWorkers, int numTasks, const LoadBalancerConfig& config, const WorkloadConfig& workload);
+
+enum ArrivalPattern { ARRIVAL_POISSON, ARRIVAL_BURSTY, ARRIVAL_PATTERN_COUNT };
+const char* arrivalPatternNames[ARRIVAL_PATTERN_COUNT] = { "poisson", "bursty" };
+
+struct OpenLoopResult {
+	double offered;
+	double throughput;
+	LatencyHistogram sojourn;
+};
+
+void waitUntil(long long due);
+double measureMeanService(int numWorkers, const LoadBalancerConfig& config, const WorkloadConfig& workload);
+OpenLoopResult runOpenLoop(int numWorkers, const LoadBalancerConfig& config, const WorkloadConfig& workload,
+	double rate, ArrivalPattern pattern, int numTasks);
+
+enum ProducerPinning { PIN_NONE, PIN_CORES, PIN_NUMA_NODES, PIN_COUNT };
+const char* producerPinningNames[PIN_COUNT] = { "no pinning", "one core per producer", "producers spread over NUMA nodes" };
+ProducerPinning producerPinning = PIN_NONE;
+
+bool pinThread(std::thread& thread, int index, ProducerPinning pinning);
+
+enum LoadBalancingTest { LB_BACKENDS = 1, LB_QUEUE_SWEEP, LB_BATCH_SWEEP, LB_TASK_GRAPH, LB_OPEN_LOOP, LB_ELASTIC, LB_SHARDED, LB_PRODUCERS,
+	LB_BACKPRESSURE, LB_PRIORITY, LB_IDLE, LB_REUSE, LB_COROUTINES, LB_NUMA, LB_TRACE, LB_TEST_COUNT };
+const char* loadBalancingTestNames[LB_TEST_COUNT - 1] = {
+	"scheduler backend comparison",
+	"lock-free queue against mutex queue sweep",
+	"batch size sweep",
+	"task graph execution",
+	"open-loop offered load sweep",
+	"elastic worker pool",
+	"sharded dispatch under skewed task sizes",
+	"multi-producer enqueue matrix",
+	"bounded queue backpressure under overload",
+	"priority and deadline scheduling of mixed work",
+	"idle strategies and wake-up latency",
+	"pool reuse with completion tokens",
+	"coroutine executor against a thread per waiting task",
+	"NUMA hierarchical queues",
+	"trace record and replay across backends"
+};
+
+void loadBalancingSuite(int test, int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void queueBackendSweep(int numTasks, int& score);
+void batchSizeSweep(int numWorkers, int numTasks, int& score);
+void taskGraphExecution(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void openLoopSweep(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void elasticPool(int numWorkers, const WorkloadConfig& workload, int& score);
+void shardedDispatch(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void producerMatrix(int numWorkers, int numTasks, int& score);
+void backpressurePolicies(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void prioritySchedulingModes(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void idleStrategies(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void poolReuse(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void coroutineExecutor(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void numaQueues(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void replayTrace(LoadBalancer& loadBalancer, const TaskTrace& trace);
+void traceReplay(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+void loadBalancing(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score);
+
+//main
+int main()
+{
+	bool reset = true;
+	while (reset) {
+		int totalScore = 0;
+		int paralelismScore = 0;
+		int maxThreadsScore = 0;
+		int loadBalancingScore = 0;
+		int piDigitsScore = 0;
+		int arithmeticScore = 0;
+
+		system("cls");
+		cpuSpecs();
+
+		int testSelectKey = 0;
+
+		std::cout << "--------------------------------------------------------------\n";
+		std::cout << "Please select one:\n";
+		std::cout << "	to run all tests press 1\n";
+		std::cout << "	to run Paralelism Test press 2\n";
+		std::cout << "	to run Maximum Thread Test press 3\n";
+		std::cout << "	to run Load Balacing Test press 4\n";
+		std::cout << "	to run Pi Digit Scaling Test press 5\n";
+		std::cout << "	to run Multiprecision Arithmetic Test press 6\n";
+		std::cout << "input: ";
+		std::cin >> testSelectKey;
+		std::cout << "--------------------------------------------------------------\n";
+		while (!std::cin.good() || testSelectKey < 1 || testSelectKey > 6) {
+			std::cin.clear();
+			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			system("cls");
+			cpuSpecsPrint();
+			std::cout << "--------------------------------------------------------------\n";
+			std::cout << "Please select one:\n";
+			std::cout << "	to run all tests press 1\n";
+			std::cout << "	to run Paralelism Test press 2\n";
+			std::cout << "	to run Maximum Thread Test press 3\n";
+			std::cout << "	to run Load Balacing Test press 4\n";
+			std::cout << "	to run Pi Digit Scaling Test press 5\n";
+			std::cout << "	to run Multiprecision Arithmetic Test press 6\n";
+			std::cout << "input: ";
+			std::cin >> testSelectKey;
+			std::cout << "--------------------------------------------------------------\n";
+		}
+
+		int precision;
+		int resolution;
+		int workload;
+		int maxExponent;
+		int maxPrecision;
+		char nothing[256];
+		int numWorkers = 0;
+		int numTasks = 0;
+		int loadBalancingTest = LB_BACKENDS;
+		int taskKind;
+		int distribution;
+		int pinning;
+		int logLevel;
+		WorkloadConfig taskWorkload;
+
+		switch (testSelectKey) {
+		case 1:
+			system("cls");
+			graphParalelism(5, paralelismScore);
+			totalScore += paralelismScore;
+
+			std::cout << "Press Enter to Continue";
+			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+			/*
+			std::cout << "\nWrite something and press enter to continue\n";
+			std::cin >> nothing;
+			std::cout << "\n";
+			*/
+
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Provide number of decimal digits for calculating number pi (recommended 1000): ";
+				std::cin >> precision;
+				std::cout << "\n";
+			} while (!std::cin.good());
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Provide the search resolution in threads (recommended " << std::max(1, numCores / 4) << "): ";
+				std::cin >> resolution;
+				std::cout << "\n";
+			} while (!std::cin.good() || resolution < 1);
+			system("cls");
+			measureMaxThreads(1, precision, resolution, PI_CHUDNOVSKY, maxThreadsScore);
+			totalScore += maxThreadsScore;
+
+			std::cout << "Press Enter to Continue";
+			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Provide inputs for number of workers and number of tasks:\n";
+				std::cout << "	number of workers: ";
+				std::cin >> numWorkers;
+			} while (!std::cin.good());
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Provide inputs for number of workers and number of tasks:\n";
+				std::cout << "	number of workers: " << numWorkers << "\n";
+				std::cout << "	number of tasks: ";
+				std::cin >> numTasks;
+				std::cout << "\n";
+			} while (!std::cin.good());
+			
+			system("cls");
+			calibrateSpin();
+			loadBalancing(numWorkers, numTasks, WorkloadConfig(), loadBalancingScore);
+			totalScore += loadBalancingScore;
+
+			std::cout << "Write something and Press Enter to Continue";
+			std::cin >> nothing;
+			break;
+
+		case 2:
+			system("cls");
+			graphParalelism(5, paralelismScore);
+			totalScore += paralelismScore;
+
+			std::cout << "Write something and Press Enter to Continue";
+			std::cin >> nothing;
+			break;
+		
+		case 3:
+			system("cls");
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Select the pi workload:\n";
+				std::cout << "	for Chudnovsky with MPFR press 1\n";
+				std::cout << "	for BBP hexadecimal digit extraction press 2\n";
+				std::cout << "input: ";
+				std::cin >> workload;
+				std::cout << "\n";
+			} while (!std::cin.good() || (workload != PI_CHUDNOVSKY && workload != PI_BBP));
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				if (workload == PI_BBP) {
+					std::cout << "Provide number of hexadecimal digits computed by each thread (recommended 1000): ";
+				}
+				else {
+					std::cout << "Provide number of decimal digits for calculating number pi (recommended 1000): ";
+				}
+				std::cin >> precision;
+				std::cout << "\n";
+			} while (!std::cin.good());
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Provide the search resolution in threads (recommended " << std::max(1, numCores / 4) << "): ";
+				std::cin >> resolution;
+				std::cout << "\n";
+			} while (!std::cin.good() || resolution < 1);
+			system("cls");
+			measureMaxThreads(workload == PI_BBP ? BBP_START_POSITION : 0, precision, resolution, PiWorkload(workload), maxThreadsScore);
+			totalScore += maxThreadsScore;
+
+			std::cout << "Press Enter to Continue";
+			std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			break;
+
+		case 4:
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Provide inputs for number of workers and number of tasks:\n";
+				std::cout << "	number of workers: ";
+				std::cin >> numWorkers;
+			} while (!std::cin.good());
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Provide inputs for number of workers and number of tasks:\n";
+				std::cout << "	number of workers: " << numWorkers << "\n";
+				std::cout << "	number of tasks: ";
+				std::cin >> numTasks;
+				std::cout << "\n";
+			} while (!std::cin.good());
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Select the load balancing test:\n";
+				for (int i = 1; i < LB_TEST_COUNT; i++) {
+					std::cout << "	for " << loadBalancingTestNames[i - 1] << " press " << i << "\n";
+				}
+				std::cout << "input: ";
+				std::cin >> loadBalancingTest;
+				std::cout << "\n";
+			} while (!std::cin.good() || loadBalancingTest < 1 || loadBalancingTest >= LB_TEST_COUNT);
+			if (loadBalancingTest == LB_PRODUCERS) {
+				do {
+					std::cin.clear();
+					std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+					system("cls");
+					std::cout << "Select the producer placement:\n";
+					for (int i = 0; i < PIN_COUNT; i++) {
+						std::cout << "	for " << producerPinningNames[i] << " press " << i + 1 << "\n";
+					}
+					std::cout << "input: ";
+					std::cin >> pinning;
+					std::cout << "\n";
+				} while (!std::cin.good() || pinning < 1 || pinning > PIN_COUNT);
+				producerPinning = ProducerPinning(pinning - 1);
+			}
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Select the task kind:\n";
+				for (int i = 0; i < TASK_KIND_COUNT; i++) {
+					std::cout << "	for " << taskKindNames[i] << " press " << i + 1 << "\n";
+				}
+				std::cout << "input: ";
+				std::cin >> taskKind;
+				std::cout << "\n";
+			} while (!std::cin.good() || taskKind < 1 || taskKind > TASK_KIND_COUNT);
+			taskWorkload.kind = TaskKind(taskKind - 1);
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Provide the work of one task in " << taskKindUnits[taskWorkload.kind]
+					<< " (recommended " << taskKindDefaultWork[taskWorkload.kind] << "): ";
+				std::cin >> taskWorkload.work;
+				std::cout << "\n";
+			} while (!std::cin.good() || taskWorkload.work < 0);
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Select the task size distribution:\n";
+				for (int i = 0; i < DIST_COUNT; i++) {
+					std::cout << "	for " << serviceDistributionNames[i] << " press " << i + 1 << "\n";
+				}
+				std::cout << "input: ";
+				std::cin >> distribution;
+				std::cout << "\n";
+			} while (!std::cin.good() || distribution < 1 || distribution > DIST_COUNT);
+			taskWorkload.distribution = ServiceDistribution(distribution - 1);
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Select the log verbosity:\n";
+				for (int i = 0; i < LOG_LEVEL_COUNT; i++) {
+					std::cout << "	for " << logLevelNames[i] << " press " << i + 1 << "\n";
+				}
+				std::cout << "input: ";
+				std::cin >> logLevel;
+				std::cout << "\n";
+			} while (!std::cin.good() || logLevel < 1 || logLevel > LOG_LEVEL_COUNT);
+			logger.setLevel(logLevel - 1);
+
+			system("cls");
+			calibrateSpin();
+			prepareChase(taskWorkload);
+			loadBalancingSuite(loadBalancingTest, numWorkers, numTasks, taskWorkload, loadBalancingScore);
+			totalScore += loadBalancingScore;
+
+			std::cout << "Write something and Press Enter to Continue";
+			std::cin >> nothing;
+			break;
+			//std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+		case 5:
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				// the series is summed term by term at full precision, so the cost grows with the square of the digits
+				std::cout << "Provide the largest power of ten of digits to reach, from 3 to " << PI_MAX_EXPONENT << " (recommended 5, "
+					<< PI_MAX_EXPONENT << " takes minutes): ";
+				std::cin >> maxExponent;
+				std::cout << "\n";
+			} while (!std::cin.good() || maxExponent < 3 || maxExponent > PI_MAX_EXPONENT);
+			system("cls");
+			graphPiDigits(maxExponent, piDigitsScore);
+			totalScore += piDigitsScore;
+
+			std::cout << "Write something and Press Enter to Continue";
+			std::cin >> nothing;
+			break;
+
+		case 6:
+			do {
+				std::cin.clear();
+				std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+				system("cls");
+				std::cout << "Provide the largest precision in bits, from 64 to 16777216 (recommended 1048576): ";
+				std::cin >> maxPrecision;
+				std::cout << "\n";
+			} while (!std::cin.good() || maxPrecision < 64 || maxPrecision > 16777216);
+			system("cls");
+			graphArithmetic(maxPrecision, arithmeticScore);
+			totalScore += arithmeticScore;
+
+			std::cout << "Write something and Press Enter to Continue";
+			std::cin >> nothing;
+			break;
+		}
+
+		int resetSelectKey;
+		do {
+			system("cls");
+			std::cout << "--------------------------------------------------------------\n";
+			std::cout << "Total score performed: " << totalScore << "\n";
+			std::cout << "--------------------------------------------------------------\n";
+			std::cout << "Please select one:\n";
+			std::cout << "	to reset press 1\n";
+			std::cout << "	to end press 2\n";
+			std::cout << "input: ";
+			std::cin >> resetSelectKey;
+			std::cout << "--------------------------------------------------------------\n";
+		} while (!std::cin.good() || (resetSelectKey != 1 && resetSelectKey != 2));
+		if (resetSelectKey == 2) {
+			reset = false;
+		}
+	}
+
+	/*
+	cpuSpecs();
+
+	graphParalelism(3, paralelismScore);
+	totalScore += paralelismScore;
+
+	measureMaxThreads(120, 1000, 1, PI_CHUDNOVSKY, maxThreadsScore);
+	totalScore += maxThreadsScore;
+	
 	loadBalancing(4, 100, loadBalancingScore);
 	totalScore += loadBalancingScore;
 	*/
@@ -402,11 +3230,122 @@ unsigned int GetCpuFrequency() {
 	return frequency;
 }
 
+long long GetProcessContextSwitches() {
+	typedef NTSTATUS(NTAPI* NtQuerySystemInformationFn)(SYSTEM_INFORMATION_CLASS, PVOID, ULONG, PULONG);
+	static NtQuerySystemInformationFn query = reinterpret_cast<NtQuerySystemInformationFn>(
+		GetProcAddress(GetModuleHandleA("ntdll.dll"), "NtQuerySystemInformation"));
+	if (query == nullptr) {
+		return -1;
+	}
+
+	std::vector<char> buffer(1 << 20);
+	ULONG length = 0;
+	NTSTATUS status;
+	while ((status = query(SystemProcessInformation, buffer.data(), (ULONG)buffer.size(), &length)) == STATUS_INFO_LENGTH_MISMATCH) {
+		buffer.resize(length + (1 << 16));
+	}
+	if (!NT_SUCCESS(status)) {
+		return -1;
+	}
+
+	// only the threads alive at the time of the query are listed
+	DWORD pid = GetCurrentProcessId();
+	char* entry = buffer.data();
+	while (true) {
+		SYSTEM_PROCESS_INFORMATION* process = reinterpret_cast<SYSTEM_PROCESS_INFORMATION*>(entry);
+		if ((DWORD)(ULONG_PTR)process->UniqueProcessId == pid) {
+			SYSTEM_THREAD_INFORMATION* threads = reinterpret_cast<SYSTEM_THREAD_INFORMATION*>(process + 1);
+			long long switches = 0;
+			for (ULONG i = 0; i < process->NumberOfThreads; i++) {
+				switches += threads[i].Reserved3;  // ContextSwitches
+			}
+			return switches;
+		}
+		if (process->NextEntryOffset == 0) {
+			break;
+		}
+		entry += process->NextEntryOffset;
+	}
+	return -1;
+}
+
+double FileTimeSeconds(const FILETIME& kernel, const FILETIME& user) {
+	// FILETIME counts 100 ns ticks
+	ULARGE_INTEGER kernelTicks, userTicks;
+	kernelTicks.LowPart = kernel.dwLowDateTime;
+	kernelTicks.HighPart = kernel.dwHighDateTime;
+	userTicks.LowPart = user.dwLowDateTime;
+	userTicks.HighPart = user.dwHighDateTime;
+	return (kernelTicks.QuadPart + userTicks.QuadPart) / 1e7;
+}
+
+double GetProcessCpuSeconds() {
+	FILETIME creation, exitTime, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exitTime, &kernel, &user)) {
+		return 0.0;
+	}
+	return FileTimeSeconds(kernel, user);
+}
+
+double GetThreadCpuSeconds() {
+	FILETIME creation, exitTime, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exitTime, &kernel, &user)) {
+		return 0.0;
+	}
+	return FileTimeSeconds(kernel, user);
+}
+
+long long GetProcessPrivateBytes() {
+	PROCESS_MEMORY_COUNTERS_EX counters;
+	counters.cb = sizeof(counters);
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), (PPROCESS_MEMORY_COUNTERS)&counters, sizeof(counters))) {
+		return 0;
+	}
+	return (long long)counters.PrivateUsage;
+}
+
+void GetCacheSizes() {
+	DWORD length = 0;
+	GetLogicalProcessorInformation(nullptr, &length);
+
+	std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+	if (info.empty() || !GetLogicalProcessorInformation(info.data(), &length)) {
+		return;
+	}
+
+	for (auto& entry : info) {
+		if (entry.Relationship != RelationCache) {
+			continue;
+		}
+		// instruction caches do not hold the limbs of the operands
+		if (entry.Cache.Type != CacheData && entry.Cache.Type != CacheUnified) {
+			continue;
+		}
+		if (entry.Cache.Level >= 1 && entry.Cache.Level <= 3) {
+			cacheSize[entry.Cache.Level - 1] = std::max(cacheSize[entry.Cache.Level - 1], (unsigned int)entry.Cache.Size);
+		}
+	}
+}
+
+const char* cacheLevelName(long long bytes) {
+	if (bytes <= cacheSize[0]) {
+		return "L1";
+	}
+	if (bytes <= cacheSize[1]) {
+		return "L2";
+	}
+	if (bytes <= cacheSize[2]) {
+		return "L3";
+	}
+	return "DRAM";
+}
+
 void cpuSpecsPrint() {
 	std::cout << "--------------------------------------------------------------\n";
 	std::cout << "CPU Name: " << cpuName << "\n";
 	std::cout << "CPU Frequency: " << frequency << "\n";
 	std::cout << "Number of Cores: " << numCores << "\n";
+	std::cout << "Cache L1/L2/L3: " << cacheSize[0] / 1024 << " KB / " << cacheSize[1] / 1024 << " KB / " << cacheSize[2] / 1024 << " KB\n";
 	std::cout << "--------------------------------------------------------------\n";
 	std::cout << "\n";
 }
@@ -425,6 +3364,9 @@ void cpuSpecs() {
 	// Get number of cores and threads
 	numCores = sysInfo.dwNumberOfProcessors;
 
+	// Get data cache sizes
+	GetCacheSizes();
+
 	cpuSpecsPrint();
 }
 
@@ -453,11 +3395,113 @@ void graphParalelism(int iterations, int& score) {
 		std::cout << "		encrypt time: " << enTime << "\n";
 		std::cout << "		decrypt time: " << deTime << "\n";
 
-		score += int(100000.0 / (enTime * 1000) + 10000.0 / (deTime * 1000));
+		score += int(100000.0 / (enTime * 1000) + 10000.0 / (deTime * 1000));
+
+		curr_threads += numCores;
+	}
+	paralelismTimes.reset();
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "\n";
+}
+
+void graphPiDigits(int maxExponent, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Pi digit scaling test:\n";
+
+	// 1, 2, 5 steps per decade so the cache transitions are not skipped
+	const int steps[] = { 1, 2, 5 };
+	int digits = 1000;
+	for (int exponent = 3; exponent <= maxExponent; exponent++) {
+		for (int step : steps) {
+			int curr_digits = digits * step;
+			if (exponent == maxExponent && step != 1) {
+				break;
+			}
+
+			auto start = std::chrono::high_resolution_clock::now();
+			mpreal result = pi(curr_digits);
+			auto stop = std::chrono::high_resolution_clock::now();
+
+			float time = std::chrono::duration<float>(stop - start).count();
+			long long workingSet = piWorkingSetBytes(curr_digits);
+			float nsPerDigit = time * 1e9f / curr_digits;
+
+			std::cout << "	for " << curr_digits << " digits:\n";
+			std::cout << "		time: " << time << "\n";
+			std::cout << "		limb working set: " << workingSet / 1024 << " KB (" << cacheLevelName(workingSet) << ")\n";
+			std::cout << "		time per digit: " << nsPerDigit << " ns\n";
+
+			piDigitsTimes.createOperation("pi_time_ms", curr_digits).count(int(time * 1000));
+			piDigitsTimes.createOperation("pi_working_set_kb", curr_digits).count(int(workingSet / 1024));
+			piDigitsTimes.createOperation("pi_ns_per_digit", curr_digits).count(int(nsPerDigit));
+
+			score += int(curr_digits / (time * 1000));
+		}
+		digits *= 10;
+	}
+	piDigitsTimes.reset("pi-digits");
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "\n";
+}
+
+void graphArithmetic(int maxPrecision, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Multiprecision arithmetic test:\n";
+
+	for (int op = 0; op < OP_COUNT; op++) {
+		std::cout << "	" << arithmeticOpNames[op] << ":\n";
+
+		float lastNs = 0;
+		int lastPrecision = 0;
+		for (int precision = 64; precision <= maxPrecision; precision *= 4) {
+			ArithmeticResult single = measureArithmetic(ArithmeticOp(op), precision, 1);
+			ArithmeticResult all = measureArithmetic(ArithmeticOp(op), precision, numCores);
+
+			float singleThroughput = single.ops / single.seconds;
+			float allThroughput = all.ops / all.seconds;
+			float ns = 1e9f / singleThroughput;
+			float scaling = allThroughput / (singleThroughput * numCores);
+
+			long long limbs = (precision + mp_bits_per_limb - 1) / mp_bits_per_limb;
+			long long workingSet = ARITHMETIC_OPERANDS * limbs * sizeof(mp_limb_t);
+
+			std::cout << "		for " << precision << " bits: " << ns << " ns/op, " << allThroughput << " ops/s on "
+				<< numCores << " threads, scaling " << scaling * 100 << "%, " << workingSet / 1024 << " KB per thread ("
+				<< cacheLevelName(workingSet) << ")";
+
+			// the growth exponent of the time tells the multiplication algorithm in use
+			if (lastPrecision != 0) {
+				float exponent = log(ns / lastNs) / log(float(precision) / lastPrecision);
+				std::cout << ", exponent " << exponent;
+				if (op == OP_MUL || op == OP_DIV || op == OP_SQRT) {
+					if (exponent > 1.8f) {
+						std::cout << " (schoolbook)";
+					}
+					else if (exponent > 1.25f) {
+						std::cout << " (Karatsuba/Toom)";
+					}
+					else {
+						std::cout << " (FFT)";
+					}
+				}
+			}
+			std::cout << "\n";
+
+			std::string name = arithmeticOpNames[op];
+			arithmeticTimes.createOperation((name + "_ns_per_limb").c_str(), precision).count(int(ns / limbs));
+			arithmeticTimes.createOperation((name + "_scaling_pct").c_str(), precision).count(int(scaling * 100));
 
-		curr_threads += numCores;
+			score += int(allThroughput * precision / 1e9);
+
+			lastNs = ns;
+			lastPrecision = precision;
+		}
 	}
-	paralelismTimes.reset();
+	arithmeticTimes.reset("arithmetic");
 
 	std::cout << "Score: " << score << "\n";
 	std::cout << "--------------------------------------------------------------\n";
@@ -549,109 +3593,155 @@ float measureMultitaskingSpeed(int n) {
 	return avg_time;
 }
 
-int measureMaxThreads(int n, int prec, int& score) {
+int measureMaxThreads(int n, int digits, int resolution, PiWorkload workload, int& score) {
 	std::cout << "--------------------------------------------------------------\n";
-	std::cout << "Maximum running threads test for calculating nTh digit of pi\n";
+	if (workload == PI_BBP) {
+		std::cout << "Maximum running threads test for extracting hexadecimal digits of pi (BBP)\n";
+	}
+	else {
+		std::cout << "Maximum running threads test for calculating nTh digit of pi\n";
+	}
 
-	float total_time = 0.0;
+	auto searchStart = std::chrono::high_resolution_clock::now();
 
-	unsigned cycles_high1 = 0, cycles_low1 = 0, cpuid_time = 0;
-	unsigned cycles_high2 = 0, cycles_low2 = 0;
-	unsigned __int64 temp_cycles1 = 0, temp_cycles2 = 0;
-	__int64 total_cycles = 0;
-	//compute the CPUID overhead
-	__asm {
-		pushad
-		CPUID
-		RDTSC
-		mov cycles_high1, edx
-		mov cycles_low1, eax
-		popad
-		pushad
-		CPUID
-		RDTSC
-		popad
-		pushad
-		CPUID
-		RDTSC
-		mov cycles_high1, edx
-		mov cycles_low1, eax
-		popad
-		pushad
-		CPUID
-		RDTSC
-		popad
-		pushad
-		CPUID
-		RDTSC
-		mov cycles_high1, edx
-		mov cycles_low1, eax
-		popad
-		pushad
-		CPUID
-		RDTSC
-		sub eax, cycles_low1
-		mov cpuid_time, eax
-		popad
+	// baseline, one thread per core
+	std::vector<float> baselineTimes;
+	for (int i = 0; i < SEARCH_MIN_SAMPLES; i++) {
+		baselineTimes.push_back(threadDigitPi(n, digits, numCores, workload).makespan);
 	}
+	std::sort(baselineTimes.begin(), baselineTimes.end());
+	float minTime = baselineTimes[baselineTimes.size() / 2];
+	std::cout << "	time for " << numCores << " threads: " << minTime << " (median of " << SEARCH_MIN_SAMPLES << ")\n";
+	int piRuns = SEARCH_MIN_SAMPLES;
+
+	// grow geometrically with single samples until the limit is crossed
+	ThreadProbe low = { numCores, SEARCH_MIN_SAMPLES, minTime, 1, 1, 1, false, false };
+	ThreadProbe high = low;
+	while (!high.exceeds && high.nrThreads < MAX_THREADS_CAP) {
+		low = high;
+		high = probeMaxThreads(n, digits, std::min(low.nrThreads * 2, MAX_THREADS_CAP), workload, minTime, 1);
+		piRuns += high.samples;
+	}
+	if (high.capped) {
+		std::cout << "	thread creation failed at " << high.nrThreads << " threads, taking it as the limit\n";
+	}
+	else if (!high.exceeds) {
+		std::cout << "	limit not reached at " << MAX_THREADS_CAP << " threads\n";
+		low = high;
+	}
+
+	// bisect the crossing interval, probes near the boundary take repeated samples
+	while (high.exceeds && high.nrThreads - low.nrThreads > resolution) {
+		ThreadProbe middle = probeMaxThreads(n, digits, (low.nrThreads + high.nrThreads) / 2, workload, minTime, SEARCH_MIN_SAMPLES);
+		piRuns += middle.samples;
+		if (middle.exceeds) {
+			high = middle;
+		}
+		else {
+			low = middle;
+		}
+	}
+	maxThreadsTimes.reset("max-threads");
+
+	float searchTime = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - searchStart).count();
+	int knee = high.nrThreads;
+
+	std::cout << "	knee: " << knee << " threads, between " << low.nrThreads << " and " << high.nrThreads << "\n";
+	std::cout << "		slowdown at " << low.nrThreads << " threads: " << low.ratio << " [" << low.ratioLow << ", " << low.ratioHigh << "]\n";
+	if (high.capped) {
+		std::cout << "		no more than " << high.nrThreads << " threads could be created\n";
+	}
+	else {
+		std::cout << "		slowdown at " << high.nrThreads << " threads: " << high.ratio << " [" << high.ratioLow << ", " << high.ratioHigh << "]\n";
+	}
+	std::cout << "	search took " << searchTime << " seconds and " << piRuns << " runs\n";
+
+	score += knee * 1000;
+	score += int(100000.0 / (high.capped ? low.makespan : high.makespan));
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "\n";
+
+	return knee;
+}
 
-	int nrThreads = numCores;
-	float minTime;
+ThreadProbe probeMaxThreads(int n, int digits, int nrThreads, PiWorkload workload, float baseline, int minSamples) {
+	// two sided 95% Student t values for 1..SEARCH_MAX_SAMPLES - 1 degrees of freedom
+	const float tValues[] = { 0, 12.71f, 4.30f, 3.18f, 2.78f, 2.57f, 2.45f };
+
+	ThreadProbe probe;
+	probe.nrThreads = nrThreads;
+	probe.samples = 0;
+	probe.capped = false;
+
+	std::vector<float> ratios;
+	float sumMakespan = 0;
+	float sumSpread = 0;
+	float sumMean = 0;
+	float sumStd = 0;
+	float sumSkew = 0;
+	long long sumSwitches = 0;
 	while (true) {
-		int nrTest = 1;
-		for (int i = 0; i < nrTest; i++) {
-			cycles_high1 = 0;
-			cycles_low1 = 0;
-			//Measure the code sequence
-			__asm {
-				pushad
-				CPUID
-				RDTSC
-				mov cycles_high1, edx
-				mov cycles_low1, eax
-				popad
-			}
-
-			//Section of code to be measured
-			threadDigitPi(n, prec, nrThreads);
-
-			__asm {
-				pushad
-				CPUID
-				RDTSC
-				mov cycles_high2, edx
-				mov cycles_low2, eax
-				popad
-			}
-			temp_cycles1 = ((unsigned __int64)cycles_high1 << 32) | cycles_low1;
-			temp_cycles2 = ((unsigned __int64)cycles_high2 << 32) | cycles_low2;
-			total_cycles = temp_cycles2 - temp_cycles1 - cpuid_time;
-
-			float sec_time = (float)total_cycles / (frequency * 1000000);
-			if (sec_time > 0) {
-				std::cout << "	time for " << nrThreads << " threads: " << sec_time << "\n";
-				if (nrThreads == numCores) {
-					minTime = sec_time;
-				}
-				else {
-					if (sec_time > PERFORMANCE_LIMIT * minTime) {
-						score += nrThreads * 1000;
-						score += int(100000.0 / sec_time);
-						std::cout << "Score: " << score << "\n";
-						std::cout << "--------------------------------------------------------------\n";
-						std::cout << "\n";
-
-						return nrThreads;
-					}
-				}
-				nrThreads += numCores;
-			}
-			else {
-				nrTest++;
+		ThreadRunStats stats = threadDigitPi(n, digits, nrThreads, workload);
+		if (stats.created < nrThreads) {
+			// the system ran out of threads, the last count that could be created is the limit
+			std::cout << "	creating " << nrThreads << " threads failed after " << stats.created << "\n";
+			probe.nrThreads = stats.created;
+			probe.samples++;
+			probe.makespan = 0;
+			probe.ratio = probe.ratioLow = probe.ratioHigh = 0;
+			probe.exceeds = true;
+			probe.capped = true;
+			return probe;
+		}
+		ratios.push_back(stats.makespan / baseline);
+		sumMakespan += stats.makespan;
+		sumSpread += stats.maxLatency - stats.minLatency;
+		sumMean += stats.meanLatency;
+		sumStd += stats.stdLatency;
+		sumSkew += stats.startSkew;
+		sumSwitches += std::max(0LL, stats.contextSwitches);
+		probe.samples++;
+
+		float mean = std::accumulate(ratios.begin(), ratios.end(), 0.0f) / probe.samples;
+		float halfWidth = 0;
+		if (probe.samples > 1) {
+			float variance = 0;
+			for (float ratio : ratios) {
+				variance += (ratio - mean) * (ratio - mean);
 			}
+			variance /= probe.samples - 1;
+			halfWidth = tValues[probe.samples - 1] * sqrt(variance / probe.samples);
+		}
+		probe.ratio = mean;
+		probe.ratioLow = mean - halfWidth;
+		probe.ratioHigh = mean + halfWidth;
+
+		if (probe.samples < minSamples) {
+			continue;
+		}
+		// keep sampling while the interval still straddles the limit
+		bool straddles = probe.samples > 1 && probe.ratioLow <= PERFORMANCE_LIMIT && probe.ratioHigh >= PERFORMANCE_LIMIT;
+		if (!straddles || probe.samples >= SEARCH_MAX_SAMPLES) {
+			break;
 		}
 	}
-	return -1;
+	probe.makespan = sumMakespan / probe.samples;
+	probe.exceeds = probe.ratio > PERFORMANCE_LIMIT;
+
+	std::cout << "	time for " << nrThreads << " threads: " << probe.makespan << " (" << probe.samples << " samples, slowdown "
+		<< probe.ratio << " [" << probe.ratioLow << ", " << probe.ratioHigh << "])\n";
+	std::cout << "		latency mean: " << sumMean / probe.samples << ", std: " << sumStd / probe.samples << ", spread: " << sumSpread / probe.samples
+		<< ", start skew: " << sumSkew / probe.samples << ", context switches: " << sumSwitches / probe.samples << "\n";
+
+	maxThreadsTimes.createOperation("makespan_ms", nrThreads).count(int(probe.makespan * 1000));
+	maxThreadsTimes.createOperation("latency_mean_ms", nrThreads).count(int(sumMean / probe.samples * 1000));
+	maxThreadsTimes.createOperation("latency_std_ms", nrThreads).count(int(sumStd / probe.samples * 1000));
+	maxThreadsTimes.createOperation("latency_spread_ms", nrThreads).count(int(sumSpread / probe.samples * 1000));
+	maxThreadsTimes.createOperation("start_skew_ms", nrThreads).count(int(sumSkew / probe.samples * 1000));
+	maxThreadsTimes.createOperation("context_switches", nrThreads).count(int(sumSwitches / probe.samples));
+
+	return probe;
 }
 
 float measureEncryption(int nrTest, bool en, int key, int n, int len, Operation& op) {
@@ -850,22 +3940,32 @@ mpreal power(int n) {
 	return r * r * 10;
 }
 
-mpreal pi(int prec) {
-	mpreal::set_default_prec(prec);  //precision
-	mpreal m = power(100000);
-	mpreal c = pow(640320, 3) / 24;
-	mpreal n = 1;
+mpreal pi(int digits) {
+	// the scale and the precision both follow the requested digits
+	mpreal::set_default_prec(mpfr::digits2bits(digits + PI_GUARD_DIGITS));  //precision
+	mpreal m = power(digits + PI_GUARD_DIGITS);
+	long int n = 1;
 	mpreal Ak = m;
 	mpreal Asum = m;
 	mpreal Bsum = 0;
 
-	int max_iterations = 10000;
-
-	while (Ak != 0) {
-		Ak *= -(6 * n - 5) * (2 * n - 1) * (6 * n - 1);
-		Ak /= n * n * n * c;
+	// every Chudnovsky term adds a little over 14 digits
+	int max_iterations = digits / PI_DIGITS_PER_TERM + 2;
+
+	while (abs(Ak) >= 1) {
+		// small integer factors one by one, they would overflow a long for big n
+		// 640320^3 / 24 is split as 26680 * 640320 * 640320 for the same reason
+		Ak *= -(6 * n - 5);
+		Ak *= 2 * n - 1;
+		Ak *= 6 * n - 1;
+		Ak /= n;
+		Ak /= n;
+		Ak /= n;
+		Ak /= 26680;
+		Ak /= 640320;
+		Ak /= 640320;
 		Asum += Ak;
-		Bsum += n * Ak;
+		Bsum += Ak * n;
 		n = n + 1;
 
 		max_iterations--;
@@ -877,31 +3977,234 @@ mpreal pi(int prec) {
 	return (426880.0 * sqrt_custom(10005 * m, m)) / (13591409 * Asum + 545140134 * Bsum);
 }
 
-void nthDigitPi(int n, int prec) {
-	mpreal result = pi(prec);
-	std::string stringPi = result.toString();
+long long piWorkingSetBytes(int digits) {
+	long long limbs = (mpfr::digits2bits(digits + PI_GUARD_DIGITS) + mp_bits_per_limb - 1) / mp_bits_per_limb;
+	return PI_LIVE_VALUES * limbs * sizeof(mp_limb_t);
+}
+
+int nthDigitPi(int n, int digits) {
+	mpreal result = pi(digits);
+	std::string stringPi = result.toString(digits + 1);
 
-	/*
-	if (n < stringPi.size()) {
-		std::cout << "Digit at position " << n << " of pi is " << stringPi.substr(n + 1, 1) << std::endl;
+	// position 0 is the leading 3, the decimals start after the point
+	if (n < 0 || n > digits) {
+		return -1;
 	}
-	else {
-		std::cout << "Error" << std::endl;
+	if (n == 0) {
+		return stringPi[0] - '0';
 	}
-	*/
+	return stringPi[n + 1] - '0';
+}
+
+ThreadRunStats threadDigitPi(int n, int digits, int nrThreads, PiWorkload workload) {
+	std::vector<std::thread> threads;
+	std::vector<std::chrono::high_resolution_clock::time_point> startTimes(nrThreads);
+	std::vector<std::chrono::high_resolution_clock::time_point> endTimes(nrThreads);
+	ThreadGate startGate;
+	ThreadGate finishGate;
+	std::atomic<bool> aborted(false);
+	// the results go somewhere the optimizer cannot see through, so the work is never dropped
+	std::atomic<long long> checksum(0);
+
+	// every thread is created and parked first, so creation is not part of the measurement
+	for (int i = 0; i < nrThreads; i++) {
+		try {
+			threads.emplace_back([&, i] {
+				startGate.arriveAndWait();
+				if (aborted) {
+					return;
+				}
+				startTimes[i] = std::chrono::high_resolution_clock::now();
+				if (workload == PI_BBP) {
+					// every thread computes the same window, later positions cost more and would skew the spread
+					checksum += bbpDigits(n, digits);
+				}
+				else {
+					checksum += nthDigitPi(n, digits);
+				}
+				endTimes[i] = std::chrono::high_resolution_clock::now();
+				// stay alive until the context switches of this thread are read
+				finishGate.arriveAndWait();
+			});
+		}
+		catch (const std::system_error&) {
+			break;
+		}
+	}
+
+	ThreadRunStats stats;
+	stats.created = int(threads.size());
+	if (stats.created < nrThreads) {
+		// out of threads or address space, let the parked ones go without measuring anything
+		aborted = true;
+		startGate.release();
+		for (auto& thread : threads) {
+			thread.join();
+		}
+		stats.makespan = stats.minLatency = stats.maxLatency = 0;
+		stats.meanLatency = stats.stdLatency = stats.startSkew = 0;
+		stats.contextSwitches = -1;
+		return stats;
+	}
+
+	startGate.waitFor(nrThreads);
+	long long switchesBefore = GetProcessContextSwitches();
+	auto release = std::chrono::high_resolution_clock::now();
+	startGate.release();
+
+	finishGate.waitFor(nrThreads);
+	long long switchesAfter = GetProcessContextSwitches();
+	finishGate.release();
+
+	for (auto& thread : threads) {
+		thread.join();
+	}
+
+	stats.minLatency = std::numeric_limits<float>::max();
+	stats.maxLatency = 0;
+	float sum = 0;
+	float sumSquares = 0;
+	auto firstStart = startTimes[0];
+	auto lastStart = startTimes[0];
+	for (int i = 0; i < nrThreads; i++) {
+		float latency = std::chrono::duration<float>(endTimes[i] - release).count();
+		stats.minLatency = std::min(stats.minLatency, latency);
+		stats.maxLatency = std::max(stats.maxLatency, latency);
+		sum += latency;
+		sumSquares += latency * latency;
+		firstStart = std::min(firstStart, startTimes[i]);
+		lastStart = std::max(lastStart, startTimes[i]);
+	}
+	stats.makespan = stats.maxLatency;
+	stats.meanLatency = sum / nrThreads;
+	stats.stdLatency = sqrt(std::max(0.0f, sumSquares / nrThreads - stats.meanLatency * stats.meanLatency));
+	stats.startSkew = std::chrono::duration<float>(lastStart - firstStart).count();
+	stats.contextSwitches = (switchesBefore < 0 || switchesAfter < 0) ? -1 : switchesAfter - switchesBefore;
+
+	return stats;
+}
+
+//bbp
+long long modPow16(long long exponent, long long modulus) {
+	long long result = 1 % modulus;
+	long long base = 16 % modulus;
+	while (exponent > 0) {
+		if (exponent & 1) {
+			result = result * base % modulus;
+		}
+		base = base * base % modulus;
+		exponent >>= 1;
+	}
+	return result;
+}
+
+double bbpSeries(int j, int n) {
+	// fractional part of sum 16^(n-k) / (8k+j), the head with modular exponentiation
+	double sum = 0;
+	for (int k = 0; k <= n; k++) {
+		long long denominator = 8LL * k + j;
+		sum += (double)modPow16(n - k, denominator) / denominator;
+		sum -= floor(sum);
+	}
+
+	// the tail terms are below one and vanish quickly
+	for (int k = n + 1; ; k++) {
+		double term = pow(16.0, n - k) / (8.0 * k + j);
+		if (term < 1e-17) {
+			break;
+		}
+		sum += term;
+	}
+	return sum - floor(sum);
+}
+
+int bbpHexDigit(int position) {
+	// position 0 is the first hexadecimal digit after the point (pi = 3.243F6A88...)
+	double x = 4 * bbpSeries(1, position) - 2 * bbpSeries(4, position) - bbpSeries(5, position) - bbpSeries(6, position);
+	x -= floor(x);
+	return int(x * 16);
+}
+
+int bbpDigits(int start, int count) {
+	int checksum = 0;
+	for (int position = start; position < start + count; position++) {
+		checksum += bbpHexDigit(position);
+	}
+	return checksum;
+}
+
+//arithmetic
+ArithmeticResult runArithmetic(ArithmeticOp op, mp_prec_t precision, float budget) {
+	// operands with every limb significant, exp and log arguments kept in a sane range
+	mpreal a = sqrt(mpreal(2, precision));
+	mpreal b = sqrt(mpreal(3, precision));
+	mpreal r(0, precision);
+	if (op == OP_EXP) {
+		a -= 1;
+	}
+
+	ArithmeticResult result = { 0, 0 };
+	long long batch = 1;
+	auto start = std::chrono::high_resolution_clock::now();
+	do {
+		for (long long i = 0; i < batch; i++) {
+			switch (op) {
+			case OP_ADD:
+				mpfr_add(r.mpfr_ptr(), a.mpfr_srcptr(), b.mpfr_srcptr(), MPFR_RNDN);
+				break;
+			case OP_MUL:
+				mpfr_mul(r.mpfr_ptr(), a.mpfr_srcptr(), b.mpfr_srcptr(), MPFR_RNDN);
+				break;
+			case OP_DIV:
+				mpfr_div(r.mpfr_ptr(), a.mpfr_srcptr(), b.mpfr_srcptr(), MPFR_RNDN);
+				break;
+			case OP_SQRT:
+				mpfr_sqrt(r.mpfr_ptr(), b.mpfr_srcptr(), MPFR_RNDN);
+				break;
+			case OP_EXP:
+				mpfr_exp(r.mpfr_ptr(), a.mpfr_srcptr(), MPFR_RNDN);
+				break;
+			case OP_LOG:
+				mpfr_log(r.mpfr_ptr(), b.mpfr_srcptr(), MPFR_RNDN);
+				break;
+			}
+		}
+		result.ops += batch;
+		result.seconds = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+
+		// reading the clock after every small add would cost more than the add
+		if (result.seconds < budget / 16) {
+			batch *= 2;
+		}
+	} while (result.seconds < budget);
+
+	return result;
 }
 
-void threadDigitPi(int n, int prec, int nrThreads) {
+ArithmeticResult measureArithmetic(ArithmeticOp op, mp_prec_t precision, int nrThreads) {
 	std::vector<std::thread> threads;
+	std::vector<ArithmeticResult> results(nrThreads);
+	ThreadGate startGate;
 
 	for (int i = 0; i < nrThreads; i++) {
-		nthDigitPi(120, 1000);
-		threads.emplace_back(nthDigitPi, n, prec);
+		threads.emplace_back([&, i] {
+			startGate.arriveAndWait();
+			results[i] = runArithmetic(op, precision, ARITHMETIC_SECONDS);
+		});
 	}
+	startGate.waitFor(nrThreads);
+	startGate.release();
 
 	for (auto& thread : threads) {
 		thread.join();
 	}
+
+	ArithmeticResult total = { 0, 0 };
+	for (auto& result : results) {
+		total.ops += result.ops;
+		total.seconds = std::max(total.seconds, result.seconds);
+	}
+	return total;
 }
 
 //encryption
@@ -991,6 +4294,24 @@ void decrypt(long int key, int n, int start, int finish)
 	}
 }
 
+void encryptChunk(long int key, int n, const char* in, char* out, int len)
+{
+	long int pt, k;
+	for (int i = 0; i < len; i++)
+	{
+		pt = in[i];
+		pt = pt - 96;
+
+		k = 1;
+		for (int j = 0; j < key; j++)
+		{
+			k = k * pt;
+			k = k % n;
+		}
+		out[i] = k + 96;
+	}
+}
+
 void tencrypt(int tid, long int key, int n, int start, int finish) {
 	float total_time = 0.0;
 
@@ -1074,9 +4395,8 @@ void tencrypt(int tid, long int key, int n, int start, int finish) {
 	temp_cycles2 = ((unsigned __int64)cycles_high2 << 32) | cycles_low2;
 	total_cycles = temp_cycles2 - temp_cycles1 - cpuid_time;
 
-	std::lock_guard<std::mutex> lock(enMutex);
 	float tTime = (float)total_cycles / (frequency * 1000000);
-	std::cout << "			thread " << tid << " finished in " << tTime << "\n";
+	logger.threadFinished(tid, tTime);
 }
 
 void tdecrypt(int tid, long int key, int n, int start, int finish){
@@ -1165,9 +4485,8 @@ void tdecrypt(int tid, long int key, int n, int start, int finish){
 	temp_cycles2 = ((unsigned __int64)cycles_high2 << 32) | cycles_low2;
 	total_cycles = temp_cycles2 - temp_cycles1 - cpuid_time;
 
-	std::lock_guard<std::mutex> lock(enMutex);
 	float tTime = (float)total_cycles / (frequency * 1000000);
-	std::cout << "			thread " << tid << " finished in " << tTime << "\n";
+	logger.threadFinished(tid, tTime);
 }
 
 void encryption(int x, int y, const int nr_threads, Operation& opEn, Operation& opDe, float& enTime, float& deTime) {
@@ -1211,14 +4530,121 @@ void encryption(int x, int y, const int nr_threads, Operation& opEn, Operation&
 	unsigned __int64 temp_cycles1 = 0, temp_cycles2 = 0;
 	__int64 total_cycles = 0;
 
-	if (nr_threads == 0) {
-		enTime = measureEncryption(1, true, keys[0], n, strlen(msg), opEn);
-		deTime = measureEncryption(1, false, keys[1], n, strlen(msg), opDe);
+	if (nr_threads == 0) {
+		enTime = measureEncryption(1, true, keys[0], n, strlen(msg), opEn);
+		deTime = measureEncryption(1, false, keys[1], n, strlen(msg), opDe);
+
+		fe << en;
+		fd << m;
+	}
+	else {
+		//measureStart
+		total_time = 0.0;
+
+		cycles_high1 = 0;
+		cycles_low1 = 0;
+		cpuid_time = 0;
+		cycles_high2 = 0;
+		cycles_low2 = 0;
+		temp_cycles1 = 0;
+		temp_cycles2 = 0;
+		total_cycles = 0;
+		//compute the CPUID overhead
+		__asm {
+			pushad
+			CPUID
+			RDTSC
+			mov cycles_high1, edx
+			mov cycles_low1, eax
+			popad
+			pushad
+			CPUID
+			RDTSC
+			popad
+			pushad
+			CPUID
+			RDTSC
+			mov cycles_high1, edx
+			mov cycles_low1, eax
+			popad
+			pushad
+			CPUID
+			RDTSC
+			popad
+			pushad
+			CPUID
+			RDTSC
+			mov cycles_high1, edx
+			mov cycles_low1, eax
+			popad
+			pushad
+			CPUID
+			RDTSC
+			sub eax, cycles_low1
+			mov cpuid_time, eax
+			popad
+		}
+
+
+		cycles_high1 = 0;
+		cycles_low1 = 0;
+
+		std::vector<std::thread> threads_encrypt;
+		std::vector<std::thread> threads_decrypt;
+
+		int len = strlen(msg) / nr_threads;
+		for (int i = 0; i < nr_threads; i++) {
+			if (i == nr_threads - 1) {
+				threads_encrypt.emplace_back(tencrypt, i + 1, keys[0], n, i * len, strlen(msg));
+			}
+			else {
+				threads_encrypt.emplace_back(tencrypt, i + 1, keys[0], n, i * len, (i + 1) * len);
+			}
+		}
+
+		//Measure the code sequence
+		__asm {
+			pushad
+			CPUID
+			RDTSC
+			mov cycles_high1, edx
+			mov cycles_low1, eax
+			popad
+		}
+
+
+		for (auto& thread : threads_encrypt) {
+			thread.join();
+		}
+
+		//measureStop
+		__asm {
+			pushad
+			CPUID
+			RDTSC
+			mov cycles_high2, edx
+			mov cycles_low2, eax
+			popad
+		}
+		temp_cycles1 = ((unsigned __int64)cycles_high1 << 32) | cycles_low1;
+		temp_cycles2 = ((unsigned __int64)cycles_high2 << 32) | cycles_low2;
+		total_cycles = temp_cycles2 - temp_cycles1 - cpuid_time;
+
+		enTime = (float)total_cycles / (frequency * 1000000);
+		opEn.count(long int(total_cycles));
+		logger.flush();
 
 		fe << en;
-		fd << m;
-	}
-	else {
+
+		for (int i = 0; i < nr_threads; i++) {
+			if (i == nr_threads - 1) {
+				threads_decrypt.emplace_back(tdecrypt, i + nr_threads, keys[1], n, i * len, strlen(msg));
+			}
+			else {
+				threads_decrypt.emplace_back(tdecrypt, i + nr_threads, keys[1], n, i * len, (i + 1) * len);
+			}
+		}
+
 		//measureStart
 		total_time = 0.0;
 
@@ -1267,158 +4693,1478 @@ void encryption(int x, int y, const int nr_threads, Operation& opEn, Operation&
 		}
 
 
-		cycles_high1 = 0;
-		cycles_low1 = 0;
+		cycles_high1 = 0;
+		cycles_low1 = 0;
+		//Measure the code sequence
+		__asm {
+			pushad
+			CPUID
+			RDTSC
+			mov cycles_high1, edx
+			mov cycles_low1, eax
+			popad
+		}
+
+		for (auto& thread : threads_decrypt) {
+			thread.join();
+		}
+		
+		//measureStop
+		__asm {
+			pushad
+			CPUID
+			RDTSC
+			mov cycles_high2, edx
+			mov cycles_low2, eax
+			popad
+		}
+		temp_cycles1 = ((unsigned __int64)cycles_high1 << 32) | cycles_low1;
+		temp_cycles2 = ((unsigned __int64)cycles_high2 << 32) | cycles_low2;
+		total_cycles = temp_cycles2 - temp_cycles1 - cpuid_time;
+
+		deTime = (float)total_cycles / (frequency * 1000000);
+		opDe.count(long int(total_cycles));
+		logger.flush();
+		fd << m;
+	}
+	fe.close();
+	fd.close();
+}
+
+//load balacing
+long long timestampNs() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
+}
+
+TaskScheduler* createScheduler(SchedulerBackend backend, int numWorkers) {
+	switch (backend) {
+	case WORK_STEALING:
+		return new WorkStealingScheduler(numWorkers);
+	case LOCK_FREE_QUEUE:
+		return new LockFreeQueueScheduler(MPMC_CAPACITY);
+	case SHARDED_ROUND_ROBIN:
+		return new ShardedScheduler(numWorkers, false);
+	case SHARDED_TWO_CHOICES:
+		return new ShardedScheduler(numWorkers, true);
+	case NUMA_HIERARCHICAL:
+		return new NumaScheduler(numWorkers);
+	default:
+		return new GlobalQueueScheduler();
+	}
+}
+
+LoadBalancerConfig defaultConfig(SchedulerBackend backend) {
+	LoadBalancerConfig config;
+	config.backend = backend;
+	// the lock-free queue would lose its point parking behind a mutex
+	config.parking = backend == LOCK_FREE_QUEUE ? PARK_EVENTCOUNT : PARK_CONDITION;
+	return config;
+}
+
+void printUtilization(const char* name, const LoadBalancingResult& result) {
+	std::string series = name;
+	std::replace(series.begin(), series.end(), ' ', '_');
+
+	for (size_t i = 0; i < result.workers.size(); ++i) {
+		const WorkerUsage& usage = result.workers[i];
+		unsigned long long total = std::max(1ULL, usage.busyCycles + usage.schedulerCycles + usage.idleCycles);
+		double busy = double(usage.busyCycles) / total;
+		int filled = int(busy * UTILIZATION_BAR_WIDTH + 0.5);
+		std::cout << "		Worker " << i << " [" << std::string(filled, '#') << std::string(UTILIZATION_BAR_WIDTH - filled, '.') << "] "
+			<< int(busy * 100) << "% busy, " << usage.tasks << " tasks, " << usage.steals << " steals, scheduler "
+			<< usage.schedulerCycles / (frequency * 1000.0) << " ms, idle " << usage.idleCycles / (frequency * 1000.0) << " ms\n";
+		utilizationTimes.createOperation((series + "_busy_pct").c_str(), int(i)).count(int(busy * 100));
+		utilizationTimes.createOperation((series + "_scheduler_pct").c_str(), int(i)).count(int(double(usage.schedulerCycles) / total * 100));
+	}
+
+	long long peak = 0;
+	double sum = 0.0;
+	for (const DepthSample& sample : result.depth) {
+		peak = std::max(peak, sample.depth);
+		sum += sample.depth;
+	}
+	std::cout << "		Queue depth: peak " << peak << ", mean " << (result.depth.empty() ? 0.0 : sum / result.depth.size())
+		<< " over " << result.depth.size() << " samples\n";
+	// thinned to a readable number of points, keyed by microseconds since the start
+	size_t step = std::max<size_t>(1, result.depth.size() / MAX_TIMELINE_POINTS);
+	for (size_t i = 0; i < result.depth.size(); i += step) {
+		utilizationTimes.createOperation((series + "_queue_depth").c_str(), int(result.depth[i].time / 1000)).count(int(result.depth[i].depth));
+	}
+}
+
+void printLatency(const char* name, const LatencyHistogram& histogram) {
+	std::cout << "		" << name << " p50/p90/p99/p99.9: "
+		<< histogram.percentile(0.5) / 1e6 << " / "
+		<< histogram.percentile(0.9) / 1e6 << " / "
+		<< histogram.percentile(0.99) / 1e6 << " / "
+		<< histogram.percentile(0.999) / 1e6 << " ms\n";
+}
+
+unsigned long long spinLoop(long long iterations) {
+	unsigned long long x = 88172645463325252ULL;
+	for (long long i = 0; i < iterations; i++) {
+		x ^= x << 13;
+		x ^= x >> 7;
+		x ^= x << 17;
+	}
+	return x;
+}
+
+void calibrateSpin() {
+	unsigned long long start = __rdtsc();
+	unsigned long long x = spinLoop(SPIN_CALIBRATION_ITERATIONS);
+	unsigned long long stop = __rdtsc();
+	spinIterationsPerCycle = double(SPIN_CALIBRATION_ITERATIONS) / double(stop - start + (x & 1));
+}
+
+void runTask(const Task& task, TaskContext& context) {
+	if (task.frame != nullptr) {
+		std::coroutine_handle<>::from_address(task.frame).resume();
+		return;
+	}
+	switch (task.kind) {
+	case TASK_SLEEP:
+		if (task.work > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(task.work));
+		}
+		break;
+
+	case TASK_SPIN:
+		context.sink += spinLoop((long long)(task.work * spinIterationsPerCycle));
+		break;
+
+	case TASK_STREAM: {
+		size_t words = std::max(1, task.work / (int)sizeof(long long));
+		if (context.stream.size() < words) {
+			context.stream.resize(words);
+		}
+		// read and write every word, one pass over the buffer
+		long long sum = 0;
+		for (size_t i = 0; i < words; i++) {
+			sum += context.stream[i];
+			context.stream[i] = sum;
+		}
+		context.sink += sum;
+		break;
+	}
+
+	case TASK_CHASE: {
+		// one step per entry the task asks for, around the cycle prepareChase() built for this workload
+		if (chaseCycle.empty()) {
+			break;
+		}
+		size_t steps = std::max(2, task.work / (int)sizeof(unsigned int));
+		unsigned int next = 0;
+		for (size_t i = 0; i < steps; i++) {
+			next = chaseCycle[next];
+		}
+		context.sink += next;
+		break;
+	}
+
+	case TASK_PI:
+		context.sink += nthDigitPi(task.work, task.work);
+		break;
+
+	case TASK_ENCRYPT: {
+		if (context.keys[0] == 0) {
+			encryption_key(context.keys, 7, 19, (7 - 1) * (19 - 1));
+		}
+		int len = std::min(task.work, (int)std::min(sizeof(en), sizeof(msg)));
+		if ((int)context.encrypted.size() < len) {
+			context.encrypted.resize(len);
+		}
+		int offset = int((long long)task.id * 4099 % (sizeof(msg) - len + 1));
+		encryptChunk(context.keys[0], 7 * 19, msg + offset, context.encrypted.data(), len);
+		context.sink += context.encrypted[0];
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+void loadBalancing(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Load balancing test for " << numWorkers << " and " << numTasks << "\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << serviceDistributionNames[workload.distribution] << " around "
+		<< workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	float bestTime = std::numeric_limits<float>::max();
+	for (int backend = 0; backend < BACKEND_COUNT; backend++) {
+		LoadBalancerConfig config = defaultConfig(SchedulerBackend(backend));
+
+		std::cout << "	Workers timers for " << schedulerBackendNames[backend] << ":\n";
+		LoadBalancingResult result = runLoadBalancing(numWorkers, numTasks, config, workload);
+
+		std::cout << "	" << schedulerBackendNames[backend] << ":\n";
+		std::cout << "		Time to complete all tasks: " << result.time << "\n";
+		std::cout << "		Throughput: " << result.tasks / result.time << " tasks/s\n";
+		std::cout << "		Steals: " << result.steals << "\n";
+		printLatency("Queue wait", result.wait);
+		printLatency("Service time", result.service);
+		printLatency("Sojourn time", result.sojourn);
+		printUtilization(schedulerBackendNames[backend], result);
+
+		bestTime = std::min(bestTime, result.time);
+	}
+	utilizationTimes.reset("utilization");
+
+	score += int(100000.0 / bestTime);
+	score *= float(numTasks) / float(numWorkers) / 10.0;
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+void loadBalancingSuite(int test, int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	switch (test) {
+	case LB_QUEUE_SWEEP:
+		queueBackendSweep(numTasks, score);
+		break;
+	case LB_BATCH_SWEEP:
+		batchSizeSweep(numWorkers, numTasks, score);
+		break;
+	case LB_TASK_GRAPH:
+		taskGraphExecution(numWorkers, numTasks, workload, score);
+		break;
+	case LB_OPEN_LOOP:
+		openLoopSweep(numWorkers, numTasks, workload, score);
+		break;
+	case LB_ELASTIC:
+		elasticPool(numWorkers, workload, score);
+		break;
+	case LB_SHARDED:
+		shardedDispatch(numWorkers, numTasks, workload, score);
+		break;
+	case LB_PRODUCERS:
+		producerMatrix(numWorkers, numTasks, score);
+		break;
+	case LB_BACKPRESSURE:
+		backpressurePolicies(numWorkers, numTasks, workload, score);
+		break;
+	case LB_PRIORITY:
+		prioritySchedulingModes(numWorkers, numTasks, workload, score);
+		break;
+	case LB_IDLE:
+		idleStrategies(numWorkers, numTasks, workload, score);
+		break;
+	case LB_REUSE:
+		poolReuse(numWorkers, numTasks, workload, score);
+		break;
+	case LB_COROUTINES:
+		coroutineExecutor(numWorkers, numTasks, workload, score);
+		break;
+	case LB_NUMA:
+		numaQueues(numWorkers, numTasks, workload, score);
+		break;
+	case LB_TRACE:
+		traceReplay(numWorkers, numTasks, workload, score);
+		break;
+	default:
+		loadBalancing(numWorkers, numTasks, workload, score);
+		break;
+	}
+}
+
+void queueBackendSweep(int numTasks, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Queue backend sweep for " << numTasks << " empty tasks\n";
+
+	const SchedulerBackend backends[] = { GLOBAL_QUEUE, LOCK_FREE_QUEUE };
+	for (SchedulerBackend backend : backends) {
+		std::cout << "	" << schedulerBackendNames[backend] << ":\n";
+		for (int numWorkers = 1; numWorkers <= MAX_SWEEP_WORKERS; numWorkers *= 2) {
+			LoadBalancerConfig config = defaultConfig(backend);
+
+			// throughput, every task is pure queue overhead
+			float time;
+			{
+				LoadBalancer loadBalancer(numWorkers, config);
+				auto start = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < numTasks; ++i) {
+					loadBalancer.enqueueTask(Task(i, 0));
+				}
+				loadBalancer.shutdown();
+				time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+			}
+			logger.flush();
+
+			// wake-up latency, tasks are spaced out so the workers are parked when each one arrives
+			LatencyHistogram waits;
+			{
+				LoadBalancer loadBalancer(numWorkers, config);
+				for (int i = 0; i < WAKEUP_SAMPLES; ++i) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(1));
+					loadBalancer.enqueueTask(Task(i, 0));
+				}
+				loadBalancer.shutdown();
+				for (auto& stats : loadBalancer.getWorkerStats()) {
+					waits.merge(stats.wait);
+				}
+			}
+			logger.flush();
+
+			float opsPerSecond = numTasks / time;
+			std::cout << "		" << numWorkers << " workers: " << opsPerSecond << " ops/s, wake-up p50/p99: "
+				<< waits.percentile(0.5) / 1e3 << " / " << waits.percentile(0.99) / 1e3 << " us\n";
+
+			score += int(opsPerSecond / 1e5);
+		}
+	}
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+void batchSizeSweep(int numWorkers, int numTasks, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Batch size sweep for " << numWorkers << " workers and " << numTasks << " empty tasks\n";
+
+	std::vector<Task> tasks;
+	for (int wake = 0; wake < WAKE_POLICY_COUNT; wake++) {
+		std::cout << "	" << schedulerBackendNames[GLOBAL_QUEUE] << ", " << wakePolicyNames[wake] << ":\n";
+		for (int batch = 1; batch <= MAX_BATCH; batch *= 2) {
+			LoadBalancerConfig config = defaultConfig(GLOBAL_QUEUE);
+			config.dequeueBatch = batch;
+			config.wake = WakePolicy(wake);
+
+			// the same batch size is used on both sides of the queue
+			float time;
+			long long locks;
+			{
+				LoadBalancer loadBalancer(numWorkers, config);
+				auto start = std::chrono::high_resolution_clock::now();
+				for (int i = 0; i < numTasks; i += batch) {
+					tasks.clear();
+					for (int j = i; j < std::min(numTasks, i + batch); ++j) {
+						tasks.push_back(Task(j, 0));
+					}
+					loadBalancer.enqueueBulk(tasks);
+				}
+				loadBalancer.shutdown();
+				time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+				locks = loadBalancer.lockAcquisitions();
+			}
+			logger.flush();
+
+			float opsPerSecond = numTasks / time;
+			std::cout << "		batch " << batch << ": " << opsPerSecond << " ops/s, "
+				<< float(locks) / numTasks << " lock acquisitions per task\n";
+
+			score += int(opsPerSecond / 1e5);
+		}
+	}
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+void forkJoinGraph(TaskGraph& graph, int depth, int fanout, const WorkloadConfig& workload) {
+	WorkSampler sampler(workload, 1);
+	// builds the subtree below fork and returns its join node
+	std::function<int(int, int)> expand = [&](int fork, int level) {
+		if (level == depth) {
+			return fork;
+		}
+		std::vector<int> ends;
+		for (int i = 0; i < fanout; ++i) {
+			int child = graph.addNode(workload.kind, sampler.next());
+			graph.addEdge(fork, child);
+			ends.push_back(expand(child, level + 1));
+		}
+		int join = graph.addNode(workload.kind, sampler.next());
+		for (int end : ends) {
+			graph.addEdge(end, join);
+		}
+		return join;
+	};
+	expand(graph.addNode(workload.kind, sampler.next()), 0);
+}
+
+void wavefrontGraph(TaskGraph& graph, int side, const WorkloadConfig& workload) {
+	WorkSampler sampler(workload, 1);
+	// cell (row, column) needs the cell above and the cell to its left
+	for (int row = 0; row < side; ++row) {
+		for (int column = 0; column < side; ++column) {
+			int node = graph.addNode(workload.kind, sampler.next());
+			if (row > 0) {
+				graph.addEdge(node - side, node);
+			}
+			if (column > 0) {
+				graph.addEdge(node - 1, node);
+			}
+		}
+	}
+}
+
+void randomGraph(TaskGraph& graph, int numNodes, int maxPredecessors, unsigned int seed, const WorkloadConfig& workload) {
+	WorkSampler sampler(workload, 1);
+	std::minstd_rand random(seed);
+	for (int node = 0; node < numNodes; ++node) {
+		graph.addNode(workload.kind, sampler.next());
+		int count = node == 0 ? 0 : random() % (maxPredecessors + 1);
+		std::vector<int> chosen;
+		for (int i = 0; i < count; ++i) {
+			int predecessor = random() % node;
+			if (std::find(chosen.begin(), chosen.end(), predecessor) == chosen.end()) {
+				chosen.push_back(predecessor);
+				graph.addEdge(predecessor, node);
+			}
+		}
+	}
+}
+
+void buildGraph(TaskGraph& graph, GraphShape shape, int numTasks, const WorkloadConfig& workload) {
+	switch (shape) {
+	case GRAPH_FORK_JOIN: {
+		// a binary tree of depth d has 3 * 2^d - 2 nodes with its joins
+		int depth = 0;
+		while (3 * (2LL << (depth + 1)) / 2 - 2 <= numTasks) {
+			depth++;
+		}
+		forkJoinGraph(graph, depth, 2, workload);
+		break;
+	}
+	case GRAPH_WAVEFRONT:
+		wavefrontGraph(graph, std::max(1, int(std::sqrt(double(numTasks)))), workload);
+		break;
+	default:
+		randomGraph(graph, std::max(1, numTasks), 3, 12345, workload);
+		break;
+	}
+}
+
+void taskGraphExecution(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Task graph execution for " << numWorkers << " workers and about " << numTasks << " tasks\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << serviceDistributionNames[workload.distribution] << " around "
+		<< workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	for (int shape = 0; shape < GRAPH_SHAPE_COUNT; shape++) {
+		TaskGraph graph;
+		buildGraph(graph, GraphShape(shape), numTasks, workload);
+		std::cout << "	" << graphShapeNames[shape] << ", " << graph.size() << " tasks:\n";
+
+		for (int backend = 0; backend < BACKEND_COUNT; backend++) {
+			LoadBalancer loadBalancer(numWorkers, defaultConfig(SchedulerBackend(backend)));
+			auto start = std::chrono::high_resolution_clock::now();
+			loadBalancer.runGraph(graph);
+			loadBalancer.shutdown();
+			float makespan = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+			logger.flush();
+
+			// both bounds use the service times measured in this run
+			const std::vector<long long>& service = loadBalancer.getGraphService();
+			long long totalWork = 0;
+			for (long long time : service) {
+				totalWork += time;
+			}
+			float criticalPath = graph.criticalPath(service) / 1e9f;
+			float workBound = totalWork / 1e9f / numWorkers;
+			float lowerBound = std::max(criticalPath, workBound);
+
+			std::cout << "		" << schedulerBackendNames[backend] << ": makespan " << makespan << " s, critical path "
+				<< criticalPath << " s, work/P " << workBound << " s, efficiency " << lowerBound / makespan * 100 << "%\n";
+
+			score += int(lowerBound / makespan * 100);
+		}
+	}
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+void waitUntil(long long due) {
+	// sleep for the coarse part, the scheduler tick is too long for the last stretch
+	long long ahead = due - timestampNs();
+	if (ahead > OPEN_LOOP_SLEEP_NS) {
+		std::this_thread::sleep_for(std::chrono::nanoseconds(ahead - OPEN_LOOP_SLEEP_NS));
+	}
+	while (timestampNs() < due) {
+		std::this_thread::yield();
+	}
+}
+
+double measureMeanService(int numWorkers, const LoadBalancerConfig& config, const WorkloadConfig& workload) {
+	// the capacity estimate comes from the service time of a closed-loop burst
+	double meanService;
+	{
+		LoadBalancer loadBalancer(numWorkers, config);
+		WorkSampler sampler(workload, numWorkers);
+		for (int i = 0; i < OPEN_LOOP_MIN_TASKS; ++i) {
+			loadBalancer.enqueueTask(Task(i, workload.kind, sampler.next()));
+		}
+		loadBalancer.shutdown();
+		LatencyHistogram service;
+		for (auto& stats : loadBalancer.getWorkerStats()) {
+			service.merge(stats.service);
+		}
+		meanService = std::max(1.0, service.mean()) / 1e9;
+	}
+	logger.flush();
+	return meanService;
+}
+
+OpenLoopResult runOpenLoop(int numWorkers, const LoadBalancerConfig& config, const WorkloadConfig& workload,
+	double rate, ArrivalPattern pattern, int numTasks) {
+	OpenLoopResult result;
+	result.offered = rate;
+
+	LoadBalancer loadBalancer(numWorkers, config);
+	long long start = timestampNs();
+
+	// the generator keeps its own schedule and never waits for the workers
+	std::thread generator([&]() {
+		std::mt19937 random(numTasks);
+		std::exponential_distribution<double> gap(rate);
+		std::geometric_distribution<int> burst(1.0 / OPEN_LOOP_MEAN_BURST);
+		WorkSampler sampler(workload, numWorkers);
+		double arrival = 0.0;
+		int remaining = 0;
+		for (int i = 0; i < numTasks; ++i) {
+			if (pattern == ARRIVAL_BURSTY) {
+				// back to back arrivals, then a pause long enough to keep the mean rate
+				if (remaining == 0) {
+					remaining = burst(random) + 1;
+					arrival += std::exponential_distribution<double>(rate / OPEN_LOOP_MEAN_BURST)(random);
+				}
+				remaining--;
+			}
+			else {
+				arrival += gap(random);
+			}
+
+			long long due = start + (long long)(arrival * 1e9);
+			waitUntil(due);
+			loadBalancer.enqueueTaskAt(Task(i, workload.kind, sampler.next()), due);
+		}
+	});
+	generator.join();
+	loadBalancer.shutdown();
+	long long finish = timestampNs();
+	logger.flush();
+
+	long long completed = 0;
+	for (auto& stats : loadBalancer.getWorkerStats()) {
+		completed += stats.tasks;
+		result.sojourn.merge(stats.sojourn);
+	}
+	result.throughput = completed / ((finish - start) / 1e9);
+	return result;
+}
+
+void openLoopSweep(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Open-loop load sweep for " << numWorkers << " workers\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << serviceDistributionNames[workload.distribution] << " around "
+		<< workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	LoadBalancerConfig config = defaultConfig(GLOBAL_QUEUE);
+	double meanService = measureMeanService(numWorkers, config, workload);
+	double capacity = numWorkers / meanService;
+	std::cout << "	Mean service time " << meanService * 1e3 << " ms, capacity " << capacity << " tasks/s\n";
+
+	for (int pattern = 0; pattern < ARRIVAL_PATTERN_COUNT; pattern++) {
+		std::cout << "	" << arrivalPatternNames[pattern] << " arrivals:\n";
+		std::string name = arrivalPatternNames[pattern];
+
+		long long baseline = 0;
+		double knee = 0.0;
+		bool saturated = false;
+		for (int load = 10; load <= 120; load += 10) {
+			double rate = capacity * load / 100.0;
+			int arrivals = std::max(OPEN_LOOP_MIN_TASKS, std::min(numTasks, int(rate * OPEN_LOOP_SECONDS)));
+			OpenLoopResult result = runOpenLoop(numWorkers, config, workload, rate, ArrivalPattern(pattern), arrivals);
+
+			long long p99 = result.sojourn.percentile(0.99);
+			if (baseline == 0 || p99 < baseline) {
+				baseline = std::max(1LL, p99);
+			}
+			// the knee is the last load whose tail stays within a few times the best tail seen so far
+			if (!saturated && p99 <= KNEE_FACTOR * baseline) {
+				knee = result.throughput;
+			}
+			else {
+				saturated = true;
+			}
+
+			std::cout << "		" << load << "% offered (" << rate << " tasks/s): " << result.throughput << " tasks/s, p50/p99 "
+				<< result.sojourn.percentile(0.5) / 1e6 << " / " << p99 / 1e6 << " ms\n";
+			// keyed by the offered load, past saturation the achieved throughput flattens and the points would collide
+			openLoopTimes.createOperation((name + "_p99_us").c_str(), load).count(int(std::min(p99 / 1000, (long long)std::numeric_limits<int>::max())));
+			openLoopTimes.createOperation((name + "_throughput").c_str(), load).count(int(result.throughput));
+		}
+
+		std::cout << "		Saturation knee: " << knee << " tasks/s, " << knee / capacity * 100 << "% of capacity\n";
+		score += int(knee / capacity * 100);
+	}
+	openLoopTimes.reset("open-loop");
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+void elasticPool(int numWorkers, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Elastic worker pool against a fixed pool of " << numWorkers << " workers\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << serviceDistributionNames[workload.distribution] << " around "
+		<< workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	LoadBalancerConfig fixedConfig = defaultConfig(GLOBAL_QUEUE);
+	LoadBalancerConfig elasticConfig = fixedConfig;
+	elasticConfig.elastic = true;
+	elasticConfig.minWorkers = std::max(1, numWorkers / 4);
+
+	double capacity = numWorkers / measureMeanService(numWorkers, fixedConfig, workload);
+	// quiet, busy, quiet again, as fractions of the full pool's capacity
+	const double phases[] = { 0.1, 0.8, 0.1 };
+	std::cout << "	Offered load " << phases[0] * 100 << "% / " << phases[1] * 100 << "% / " << phases[2] * 100
+		<< "% of " << capacity << " tasks/s, " << ELASTIC_PHASE_SECONDS << " s each\n";
+
+	long long fixedP99 = 0;
+	double fixedCpu = 0.0;
+	double fixedThreadSeconds = 0.0;
+	for (int mode = 0; mode < 2; mode++) {
+		const LoadBalancerConfig& config = mode == 0 ? fixedConfig : elasticConfig;
+		std::cout << "	" << (mode == 0 ? "fixed pool" : "elastic pool") << ":\n";
+
+		double cpuBefore = GetProcessCpuSeconds();
+		LoadBalancer loadBalancer(numWorkers, config);
+		long long start = timestampNs();
+
+		// open-loop Poisson arrivals, the rate steps at every phase boundary
+		std::mt19937 random(workload.seed);
+		WorkSampler sampler(workload, numWorkers);
+		double arrival = 0.0;
+		int id = 0;
+		for (double rateFraction : phases) {
+			double phaseEnd = arrival + ELASTIC_PHASE_SECONDS;
+			std::exponential_distribution<double> gap(capacity * rateFraction);
+			while ((arrival += gap(random)) < phaseEnd) {
+				long long due = start + (long long)(arrival * 1e9);
+				waitUntil(due);
+				loadBalancer.enqueueTaskAt(Task(id++, workload.kind, sampler.next()), due);
+			}
+			arrival = phaseEnd;
+		}
+		loadBalancer.shutdown();
+		long long finish = timestampNs();
+		double cpu = GetProcessCpuSeconds() - cpuBefore;
+		logger.flush();
+
+		LatencyHistogram sojourn;
+		LatencyHistogram scaleUp;
+		for (auto& stats : loadBalancer.getWorkerStats()) {
+			sojourn.merge(stats.sojourn);
+			scaleUp.merge(stats.scaleUp);
+		}
+
+		// thread count over time, integrated into thread-seconds
+		const std::vector<PoolEvent>& events = loadBalancer.getPoolEvents();
+		double threadSeconds = 0.0;
+		size_t step = std::max<size_t>(1, events.size() / 40);
+		for (size_t i = 0; i < events.size(); ++i) {
+			long long end = i + 1 < events.size() ? events[i + 1].time : finish;
+			threadSeconds += events[i].workers * (end - std::max(start, events[i].time)) / 1e9;
+			if (mode == 1 && (i % step == 0 || i + 1 == events.size())) {
+				double at = std::max(0LL, events[i].time - start) / 1e9;
+				std::cout << "		t=" << at << " s: " << events[i].workers << " workers\n";
+				elasticTimes.createOperation("workers", int(at * 1000)).count(events[i].workers);
+			}
+		}
+
+		long long p99 = sojourn.percentile(0.99);
+		std::cout << "		" << id << " tasks, sojourn p50/p99: " << sojourn.percentile(0.5) / 1e6 << " / " << p99 / 1e6 << " ms\n";
+		std::cout << "		Thread-seconds: " << threadSeconds << ", CPU-seconds: " << cpu << "\n";
+
+		if (mode == 0) {
+			fixedP99 = p99;
+			fixedCpu = cpu;
+			fixedThreadSeconds = threadSeconds;
+		}
+		else {
+			std::cout << "		Scale-up latency p50/p99: " << scaleUp.percentile(0.5) / 1e6 << " / " << scaleUp.percentile(0.99) / 1e6
+				<< " ms over " << scaleUp.count() << " new workers\n";
+			std::cout << "		Extra p99 against the fixed pool: " << (p99 - fixedP99) / 1e6 << " ms\n";
+			std::cout << "		Saved: " << fixedThreadSeconds - threadSeconds << " thread-seconds, " << fixedCpu - cpu << " CPU-seconds\n";
+			if (fixedThreadSeconds > 0) {
+				score += std::max(0, int((fixedThreadSeconds - threadSeconds) / fixedThreadSeconds * 100));
+			}
+		}
+	}
+	elasticTimes.reset("elastic-pool");
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+void shardedDispatch(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Sharded dispatch for " << numWorkers << " workers and " << numTasks << " tasks\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << " around " << workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	const ServiceDistribution distributions[] = { DIST_EXPONENTIAL, DIST_LOGNORMAL, DIST_PARETO, DIST_BIMODAL };
+	const SchedulerBackend backends[] = { GLOBAL_QUEUE, SHARDED_ROUND_ROBIN, SHARDED_TWO_CHOICES };
+	for (ServiceDistribution distribution : distributions) {
+		WorkloadConfig skewed = workload;
+		skewed.distribution = distribution;
+		std::cout << "	" << serviceDistributionNames[distribution] << " task sizes:\n";
+
+		float globalTime = 0.0f;
+		for (SchedulerBackend backend : backends) {
+			LoadBalancingResult result = runLoadBalancing(numWorkers, numTasks, defaultConfig(backend), skewed);
+			if (backend == GLOBAL_QUEUE) {
+				globalTime = result.time;
+			}
+
+			std::cout << "		" << schedulerBackendNames[backend] << ": " << result.tasks / result.time << " tasks/s, imbalance "
+				<< result.imbalance << " tasks, sojourn p99/p99.9 "
+				<< result.sojourn.percentile(0.99) / 1e6 << " / " << result.sojourn.percentile(0.999) / 1e6 << " ms\n";
+
+			if (backend == SHARDED_TWO_CHOICES && result.time > 0) {
+				score += int(globalTime / result.time * 100);
+			}
+		}
+	}
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+// the Ex call reports the group as well, the plain mask only covers group 0 and is cut to 32 bits in a 32-bit build
+std::vector<GROUP_AFFINITY> numaNodeAffinities() {
+	std::vector<GROUP_AFFINITY> affinities;
+	ULONG highestNode = 0;
+	if (GetNumaHighestNodeNumber(&highestNode)) {
+		for (ULONG node = 0; node <= highestNode; ++node) {
+			GROUP_AFFINITY affinity = {};
+			if (GetNumaNodeProcessorMaskEx(USHORT(node), &affinity) && affinity.Mask != 0) {
+				affinities.push_back(affinity);
+			}
+		}
+	}
+	if (affinities.empty()) {
+		affinities.push_back(GROUP_AFFINITY());
+	}
+	return affinities;
+}
+
+bool pinThread(std::thread& thread, int index, ProducerPinning pinning) {
+	DWORD_PTR mask;
+	if (pinning == PIN_NUMA_NODES) {
+		std::vector<GROUP_AFFINITY> nodes = numaNodeAffinities();
+		if (nodes[0].Mask == 0) {
+			return false;
+		}
+		GROUP_AFFINITY affinity = nodes[index % nodes.size()];
+		return SetThreadGroupAffinity((HANDLE)thread.native_handle(), &affinity, nullptr) != 0;
+	}
+	else if (pinning == PIN_CORES) {
+		mask = DWORD_PTR(1) << (index % std::min(numCores, int(sizeof(DWORD_PTR) * 8)));
+	}
+	else {
+		return true;
+	}
+	return SetThreadAffinityMask((HANDLE)thread.native_handle(), mask) != 0;
+}
+
+// each producer records into its own slot, padded apart so the histogram totals do not share a cache line
+struct ProducerLatency {
+	LatencyHistogram latency;
+	char padding[64];
+};
+
+void producerMatrix(int numWorkers, int numTasks, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Multi-producer enqueue matrix for up to " << numWorkers << " consumers and " << numTasks << " empty tasks\n";
+	std::cout << "	Producers: " << producerPinningNames[producerPinning] << "\n";
+
+	int maxProducers = std::max(1, std::min(numCores, MAX_PRODUCERS));
+	for (int backend = 0; backend < BACKEND_COUNT; backend++) {
+		std::cout << "	" << schedulerBackendNames[backend] << ", Mtasks/s and enqueue p99 in us, producers down, consumers across:\n";
+		std::cout << "		P\\C";
+		for (int consumers = 1; consumers <= numWorkers; consumers *= 2) {
+			std::cout << "	" << consumers;
+		}
+		std::cout << "\n";
+
+		for (int producers = 1; producers <= maxProducers; producers *= 2) {
+			std::cout << "		" << producers;
+			for (int consumers = 1; consumers <= numWorkers; consumers *= 2) {
+				LoadBalancer loadBalancer(consumers, defaultConfig(SchedulerBackend(backend)));
+				std::vector<ProducerLatency> enqueueLatency(producers);
+				std::vector<std::thread> threads;
+				ThreadGate startGate;
+
+				// every producer submits its own share as fast as it can
+				for (int p = 0; p < producers; ++p) {
+					threads.emplace_back([&, p]() {
+						startGate.arriveAndWait();
+						for (int i = p; i < numTasks; i += producers) {
+							long long before = timestampNs();
+							loadBalancer.enqueueTask(Task(i, 0));
+							enqueueLatency[p].latency.record(timestampNs() - before);
+						}
+					});
+					pinThread(threads.back(), p, producerPinning);
+				}
+				startGate.waitFor(producers);
+
+				auto start = std::chrono::high_resolution_clock::now();
+				startGate.release();
+				for (auto& thread : threads) {
+					thread.join();
+				}
+				loadBalancer.shutdown();
+				float time = std::chrono::duration<float>(std::chrono::high_resolution_clock::now() - start).count();
+				logger.flush();
+
+				LatencyHistogram latency;
+				for (auto& producer : enqueueLatency) {
+					latency.merge(producer.latency);
+				}
+				float tasksPerSecond = numTasks / time;
+				std::cout << "	" << tasksPerSecond / 1e6 << " / " << latency.percentile(0.99) / 1e3;
 
-		std::vector<std::thread> threads_encrypt;
-		std::vector<std::thread> threads_decrypt;
+				score += int(tasksPerSecond / 1e5);
+			}
+			std::cout << "\n";
+		}
+	}
 
-		int len = strlen(msg) / nr_threads;
-		for (int i = 0; i < nr_threads; i++) {
-			if (i == nr_threads - 1) {
-				threads_encrypt.emplace_back(tencrypt, i + 1, keys[0], n, i * len, strlen(msg));
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+void backpressurePolicies(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Backpressure under overload for " << numWorkers << " workers and " << numTasks << " tasks\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << serviceDistributionNames[workload.distribution] << " around "
+		<< workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	LoadBalancerConfig unbounded = defaultConfig(GLOBAL_QUEUE);
+	double capacity = numWorkers / measureMeanService(numWorkers, unbounded, workload);
+	double rate = capacity * OVERLOAD_FACTOR;
+	long long queueCapacity = std::max(64, numWorkers * 16);
+	std::cout << "	Offered " << rate << " tasks/s against a capacity of " << capacity << " tasks/s, queue bound " << queueCapacity << " tasks\n";
+
+	// the first run leaves the queue unbounded as the reference
+	for (int policy = -1; policy < BP_POLICY_COUNT; policy++) {
+		LoadBalancerConfig config = unbounded;
+		// a bound nothing reaches keeps the high-water mark without ever blocking
+		config.capacity = std::numeric_limits<long long>::max();
+		if (policy >= 0) {
+			config.capacity = queueCapacity;
+			config.backpressure = BackpressurePolicy(policy);
+		}
+		std::cout << "	" << (policy < 0 ? "unbounded" : backpressurePolicyNames[policy]) << ":\n";
+
+		LoadBalancer loadBalancer(numWorkers, config);
+		std::mt19937 random(workload.seed);
+		std::exponential_distribution<double> gap(rate);
+		WorkSampler sampler(workload, numWorkers);
+		long long start = timestampNs();
+		double arrival = 0.0;
+		for (int i = 0; i < numTasks; ++i) {
+			// a stalled producer falls behind its schedule, the due time keeps that in the latency
+			arrival += gap(random);
+			long long due = start + (long long)(arrival * 1e9);
+			waitUntil(due);
+			loadBalancer.enqueueTaskAt(Task(i, workload.kind, sampler.next()), due);
+		}
+		loadBalancer.shutdown();
+		float time = (timestampNs() - start) / 1e9f;
+		logger.flush();
+
+		LatencyHistogram sojourn = loadBalancer.getCallerSojourn();
+		long long completed = sojourn.count();
+		for (auto& stats : loadBalancer.getWorkerStats()) {
+			sojourn.merge(stats.sojourn);
+			completed += stats.tasks;
+		}
+		BackpressureStats stats = loadBalancer.getBackpressureStats();
+
+		std::cout << "		High-water mark: " << stats.highWater << " tasks, " << stats.highWater * sizeof(Task) / 1024.0 << " KB of queued tasks\n";
+		std::cout << "		Producer stall: " << stats.stallNs / 1e6 << " ms, dropped " << stats.dropped << ", run by the caller " << stats.callerRuns << "\n";
+		std::cout << "		" << completed << " tasks done at " << completed / time << " tasks/s, sojourn p50/p99/p99.9: "
+			<< sojourn.percentile(0.5) / 1e6 << " / " << sojourn.percentile(0.99) / 1e6 << " / " << sojourn.percentile(0.999) / 1e6 << " ms\n";
+
+		if (policy >= 0) {
+			score += int(completed / time / capacity * 10);
+		}
+	}
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+void prioritySchedulingModes(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Priority and deadline scheduling for " << numWorkers << " workers and " << numTasks << " tasks\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << INTERACTIVE_FRACTION * 100 << "% interactive of "
+		<< workload.work << " " << taskKindUnits[workload.kind] << ", the rest batch " << serviceDistributionNames[workload.distribution]
+		<< " around " << workload.work * BATCH_WORK_FACTOR << " " << taskKindUnits[workload.kind] << "\n";
+
+	double meanService = measureMeanService(numWorkers, defaultConfig(GLOBAL_QUEUE), workload);
+	double mixedService = meanService * (INTERACTIVE_FRACTION + (1 - INTERACTIVE_FRACTION) * BATCH_WORK_FACTOR);
+	double rate = numWorkers / mixedService * MIXED_LOAD;
+	long long interactiveDeadline = (long long)(meanService * INTERACTIVE_DEADLINE_FACTOR * 1e9);
+	long long batchDeadline = (long long)(meanService * BATCH_DEADLINE_FACTOR * 1e9);
+	std::cout << "	Offered " << rate << " tasks/s at " << MIXED_LOAD * 100 << "% load, deadlines " << interactiveDeadline / 1e6
+		<< " ms interactive and " << batchDeadline / 1e6 << " ms batch\n";
+
+	for (int mode = 0; mode < SCHEDULE_MODE_COUNT; mode++) {
+		LoadBalancerConfig config = defaultConfig(GLOBAL_QUEUE);
+		config.scheduling = SchedulingMode(mode);
+		std::cout << "	" << schedulingModeNames[mode] << ":\n";
+
+		LoadBalancer loadBalancer(numWorkers, config);
+		// the same seed gives every mode the same arrivals and task mix
+		std::mt19937 random(workload.seed);
+		std::exponential_distribution<double> gap(rate);
+		std::bernoulli_distribution interactive(INTERACTIVE_FRACTION);
+		WorkSampler sampler(workload, numWorkers);
+		long long start = timestampNs();
+		double arrival = 0.0;
+		for (int i = 0; i < numTasks; ++i) {
+			arrival += gap(random);
+			long long due = start + (long long)(arrival * 1e9);
+			Task task(i, workload.kind, workload.work);
+			if (interactive(random)) {
+				task.priority = 0;
+				task.deadline = due + interactiveDeadline;
 			}
 			else {
-				threads_encrypt.emplace_back(tencrypt, i + 1, keys[0], n, i * len, (i + 1) * len);
+				task.work = sampler.next() * BATCH_WORK_FACTOR;
+				task.priority = 1;
+				task.deadline = due + batchDeadline;
 			}
+			waitUntil(due);
+			loadBalancer.enqueueTaskAt(task, due);
 		}
-
-		//Measure the code sequence
-		__asm {
-			pushad
-			CPUID
-			RDTSC
-			mov cycles_high1, edx
-			mov cycles_low1, eax
-			popad
+		loadBalancer.shutdown();
+		float time = (timestampNs() - start) / 1e9f;
+		logger.flush();
+
+		long long completed = 0;
+		double interactiveMissRate = 0.0;
+		for (int c = 0; c < PRIORITY_CLASSES; ++c) {
+			LatencyHistogram sojourn;
+			long long tasks = 0, deadlineTasks = 0, misses = 0;
+			for (auto& stats : loadBalancer.getWorkerStats()) {
+				sojourn.merge(stats.classSojourn[c]);
+				tasks += stats.classTasks[c];
+				deadlineTasks += stats.deadlineTasks[c];
+				misses += stats.deadlineMisses[c];
+			}
+			double missRate = deadlineTasks == 0 ? 0.0 : double(misses) / deadlineTasks;
+			if (c == 0) {
+				interactiveMissRate = missRate;
+			}
+			completed += tasks;
+			std::cout << "		" << priorityClassNames[c] << ": " << tasks << " tasks at " << tasks / time << " tasks/s, deadline misses "
+				<< missRate * 100 << "%\n";
+			printLatency("	sojourn", sojourn);
 		}
+		std::cout << "		Throughput: " << completed / time << " tasks/s\n";
 
+		score += int((1.0 - interactiveMissRate) * 10);
+	}
 
-		for (auto& thread : threads_encrypt) {
-			thread.join();
-		}
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
 
-		//measureStop
-		__asm {
-			pushad
-			CPUID
-			RDTSC
-			mov cycles_high2, edx
-			mov cycles_low2, eax
-			popad
+void idleStrategies(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Idle strategies for " << numWorkers << " workers and " << numTasks << " tasks\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << serviceDistributionNames[workload.distribution] << " around "
+		<< workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	// at low load most tasks arrive to an idle pool, so the queue wait is the wake-up latency
+	double rate = numWorkers / measureMeanService(numWorkers, defaultConfig(GLOBAL_QUEUE), workload) * IDLE_LOAD;
+	std::cout << "	Offered " << rate << " tasks/s at " << IDLE_LOAD * 100 << "% load\n";
+
+	for (int strategy = 0; strategy < IDLE_STRATEGY_COUNT; strategy++) {
+		LoadBalancerConfig config = defaultConfig(GLOBAL_QUEUE);
+		config.idle = IdleStrategy(strategy);
+		std::cout << "	" << idleStrategyNames[strategy] << ":\n";
+
+		LoadBalancer loadBalancer(numWorkers, config);
+		std::mt19937 random(workload.seed);
+		std::exponential_distribution<double> gap(rate);
+		WorkSampler sampler(workload, numWorkers);
+		long long start = timestampNs();
+		double arrival = 0.0;
+		for (int i = 0; i < numTasks; ++i) {
+			arrival += gap(random);
+			long long due = start + (long long)(arrival * 1e9);
+			waitUntil(due);
+			loadBalancer.enqueueTaskAt(Task(i, workload.kind, sampler.next()), due);
 		}
-		temp_cycles1 = ((unsigned __int64)cycles_high1 << 32) | cycles_low1;
-		temp_cycles2 = ((unsigned __int64)cycles_high2 << 32) | cycles_low2;
-		total_cycles = temp_cycles2 - temp_cycles1 - cpuid_time;
+		loadBalancer.shutdown();
+		double time = (timestampNs() - start) / 1e9;
+		logger.flush();
+
+		LatencyHistogram wakeUp;
+		long long spinHits = 0, parks = 0;
+		double cpu = 0.0, busy = 0.0;
+		for (auto& stats : loadBalancer.getWorkerStats()) {
+			wakeUp.merge(stats.wait);
+			spinHits += stats.spinHits;
+			parks += stats.parks;
+			cpu += stats.cpuSeconds;
+			busy += stats.service.mean() * stats.service.count() / 1e9;
+		}
+		// the worker threads' own CPU time, so the spinning producer is left out
+		double idleCpu = std::max(0.0, cpu - busy);
 
-		enTime = (float)total_cycles / (frequency * 1000000);
-		opEn.count(long int(total_cycles));
+		printLatency("Wake-up", wakeUp);
+		std::cout << "		Idle periods: " << spinHits << " ended spinning, " << parks << " parked\n";
+		std::cout << "		Idle CPU: " << idleCpu << " s, " << idleCpu / time << " cores on average\n";
 
-		fe << en;
+		score += int(100 / (1 + wakeUp.percentile(0.5) / 1e3));
+	}
 
-		for (int i = 0; i < nr_threads; i++) {
-			if (i == nr_threads - 1) {
-				threads_decrypt.emplace_back(tdecrypt, i + nr_threads, keys[1], n, i * len, strlen(msg));
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+void poolReuse(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	int perRound = std::max(1, numTasks / REUSE_ROUNDS);
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Pool reuse for " << numWorkers << " workers, " << REUSE_ROUNDS << " rounds of " << perRound << " tasks\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << serviceDistributionNames[workload.distribution] << " around "
+		<< workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	LoadBalancerConfig config = defaultConfig(GLOBAL_QUEUE);
+
+	// a fresh pool per round starts its threads every time and only sees the end at the join
+	LatencyHistogram rebuiltRound, rebuiltLag;
+	for (int round = 0; round < REUSE_ROUNDS; round++) {
+		long long start = timestampNs();
+		LoadBalancer loadBalancer(numWorkers, config);
+		WorkSampler sampler(workload, numWorkers);
+		for (int i = 0; i < perRound; ++i) {
+			loadBalancer.enqueueTask(Task(i, workload.kind, sampler.next()));
+		}
+		loadBalancer.shutdown();
+		long long end = timestampNs();
+		rebuiltRound.record(end - start);
+		rebuiltLag.record(end - loadBalancer.lastCompletionTime());
+	}
+	logger.flush();
+
+	// one pool for every round, waitIdle() is the barrier between them
+	LatencyHistogram reusedRound, reusedLag;
+	long long submitted = 0, ready = 0, cancelled = 0, ran = 0;
+	{
+		LoadBalancer loadBalancer(numWorkers, config);
+		std::vector<TaskFuture> futures;
+		futures.reserve(perRound);
+		for (int round = 0; round < REUSE_ROUNDS; round++) {
+			futures.clear();
+			long long start = timestampNs();
+			WorkSampler sampler(workload, numWorkers);
+			for (int i = 0; i < perRound; ++i) {
+				futures.push_back(loadBalancer.submit(Task(i, workload.kind, sampler.next())));
+			}
+			loadBalancer.waitIdle();
+			long long end = timestampNs();
+			reusedRound.record(end - start);
+			reusedLag.record(end - loadBalancer.lastCompletionTime());
+			for (auto& future : futures) {
+				ready += future.ready();
+			}
+			submitted += perRound;
+		}
+
+		// a last round that is cancelled right away, what already started still finishes
+		futures.clear();
+		WorkSampler sampler(workload, numWorkers);
+		for (int i = 0; i < perRound; ++i) {
+			futures.push_back(loadBalancer.submit(Task(i, workload.kind, sampler.next())));
+		}
+		loadBalancer.shutdown(SHUTDOWN_CANCEL);
+		for (auto& future : futures) {
+			if (future.wait() == TASK_CANCELLED) {
+				cancelled++;
 			}
 			else {
-				threads_decrypt.emplace_back(tdecrypt, i + nr_threads, keys[1], n, i * len, (i + 1) * len);
+				ran++;
 			}
 		}
+	}
+	logger.flush();
 
-		//measureStart
-		total_time = 0.0;
+	std::cout << "	Pool rebuilt every round:\n";
+	printLatency("Round", rebuiltRound);
+	std::cout << "		Join after the last task: " << rebuiltLag.percentile(0.5) / 1e3 << " us median\n";
+	std::cout << "	One pool with waitIdle():\n";
+	printLatency("Round", reusedRound);
+	std::cout << "		Barrier after the last task: " << reusedLag.percentile(0.5) / 1e3 << " us median\n";
+	std::cout << "		Futures ready at the barrier: " << ready << " of " << submitted << "\n";
+	std::cout << "	Cancelled shutdown: " << ran << " ran, " << cancelled << " cancelled of " << perRound << "\n";
 
-		cycles_high1 = 0;
-		cycles_low1 = 0;
-		cpuid_time = 0;
-		cycles_high2 = 0;
-		cycles_low2 = 0;
-		temp_cycles1 = 0;
-		temp_cycles2 = 0;
-		total_cycles = 0;
-		//compute the CPUID overhead
-		__asm {
-			pushad
-			CPUID
-			RDTSC
-			mov cycles_high1, edx
-			mov cycles_low1, eax
-			popad
-			pushad
-			CPUID
-			RDTSC
-			popad
-			pushad
-			CPUID
-			RDTSC
-			mov cycles_high1, edx
-			mov cycles_low1, eax
-			popad
-			pushad
-			CPUID
-			RDTSC
-			popad
-			pushad
-			CPUID
-			RDTSC
-			mov cycles_high1, edx
-			mov cycles_low1, eax
-			popad
-			pushad
-			CPUID
-			RDTSC
-			sub eax, cycles_low1
-			mov cpuid_time, eax
-			popad
+	score += int(rebuiltRound.mean() / std::max(1.0, reusedRound.mean()) * 10);
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+// shared by every waiting task of one run, whichever model runs them
+struct AsyncProbe {
+	std::mutex mutex;
+	LatencyHistogram lateness;
+	LatencyHistogram sojourn;
+	std::atomic<int> live;
+	std::atomic<int> peak;
+	std::atomic<int> remaining;
+
+	AsyncProbe(int tasks) : live(0), peak(0), remaining(tasks) {}
+
+	void started() {
+		int now = ++live;
+		int seen = peak.load();
+		while (now > seen && !peak.compare_exchange_weak(seen, now)) {
 		}
+	}
 
+	void woke(long long due) {
+		long long late = timestampNs() - due;
+		std::lock_guard<std::mutex> lock(mutex);
+		lateness.record(std::max(0LL, late));
+	}
 
-		cycles_high1 = 0;
-		cycles_low1 = 0;
-		//Measure the code sequence
-		__asm {
-			pushad
-			CPUID
-			RDTSC
-			mov cycles_high1, edx
-			mov cycles_low1, eax
-			popad
+	void finished(long long spawned) {
+		long long time = timestampNs() - spawned;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			sojourn.record(time);
 		}
+		live--;
+		remaining--;
+	}
+};
 
-		for (auto& thread : threads_decrypt) {
+TaskContext& threadContext() {
+	thread_local TaskContext context;
+	return context;
+}
+
+// the same steps as ioThread(), a wait followed by a bit of work, but the waits hold no thread
+AsyncTask ioCoroutine(TimerWheel& wheel, AsyncProbe& probe, Task work, long long spawned) {
+	probe.started();
+	for (int step = 0; step < ASYNC_IO_STEPS; ++step) {
+		long long due = timestampNs() + ASYNC_IO_MS * 1000000LL;
+		co_await wheel.sleepUntil(due);
+		probe.woke(due);
+		runTask(work, threadContext());
+	}
+	probe.finished(spawned);
+}
+
+void ioThread(AsyncProbe& probe, Task work, long long spawned) {
+	probe.started();
+	for (int step = 0; step < ASYNC_IO_STEPS; ++step) {
+		long long due = timestampNs() + ASYNC_IO_MS * 1000000LL;
+		std::this_thread::sleep_for(std::chrono::milliseconds(ASYNC_IO_MS));
+		probe.woke(due);
+		runTask(work, threadContext());
+	}
+	probe.finished(spawned);
+}
+
+void coroutineExecutor(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Coroutine executor for " << numTasks << " waiting tasks, " << ASYNC_IO_STEPS << " waits of " << ASYNC_IO_MS << " ms each\n";
+	std::cout << "	Work after each wait: " << taskKindNames[workload.kind] << ", " << workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	Task work(0, workload.kind, workload.work);
+	// the default 15.6 ms timer would swamp a 1 ms wheel tick, both models get the finer timer
+	bool fineTimer = timeBeginPeriod(1) == TIMERR_NOERROR;
+
+	// one OS thread per task, every wait holds its thread in sleep_for
+	int threadPeak;
+	long long threadBytes;
+	double threadTime;
+	LatencyHistogram threadLateness, threadSojourn;
+	{
+		AsyncProbe probe(numTasks);
+		std::vector<std::thread> threads;
+		threads.reserve(numTasks);
+		long long memoryBefore = GetProcessPrivateBytes();
+		long long start = timestampNs();
+		for (int i = 0; i < numTasks; ++i) {
+			try {
+				threads.emplace_back(ioThread, std::ref(probe), work, timestampNs());
+			}
+			catch (const std::system_error&) {
+				// out of threads, the tasks that did not start count as never run
+				probe.remaining -= numTasks - i;
+				break;
+			}
+		}
+		long long memoryAfter = GetProcessPrivateBytes();
+		int started = std::max(1, probe.live.load());
+		for (auto& thread : threads) {
 			thread.join();
 		}
-		
-		//measureStop
-		__asm {
-			pushad
-			CPUID
-			RDTSC
-			mov cycles_high2, edx
-			mov cycles_low2, eax
-			popad
+		threadTime = (timestampNs() - start) / 1e9;
+		threadPeak = probe.peak.load();
+		threadBytes = (memoryAfter - memoryBefore) / started;
+		threadLateness = probe.lateness;
+		threadSojourn = probe.sojourn;
+		if ((int)threads.size() < numTasks) {
+			std::cout << "	Thread creation failed after " << threads.size() << " threads\n";
 		}
-		temp_cycles1 = ((unsigned __int64)cycles_high1 << 32) | cycles_low1;
-		temp_cycles2 = ((unsigned __int64)cycles_high2 << 32) | cycles_low2;
-		total_cycles = temp_cycles2 - temp_cycles1 - cpuid_time;
+	}
 
-		deTime = (float)total_cycles / (frequency * 1000000);
-		opDe.count(long int(total_cycles));
-		fd << m;
+	// the same tasks as coroutines, numWorkers threads run every step and a timer wheel resumes them
+	int coroutinePeak;
+	long long coroutineBytes;
+	long long frameBytes;
+	double coroutineTime;
+	double tickNs;
+	LatencyHistogram coroutineLateness, coroutineSojourn;
+	{
+		AsyncProbe probe(numTasks);
+		LoadBalancer loadBalancer(numWorkers, defaultConfig(GLOBAL_QUEUE));
+		{
+			TimerWheel wheel(loadBalancer);
+			long long framesBefore = asyncFrameBytes.load();
+			long long memoryBefore = GetProcessPrivateBytes();
+			long long start = timestampNs();
+			for (int i = 0; i < numTasks; ++i) {
+				loadBalancer.spawn(ioCoroutine(wheel, probe, work, timestampNs()));
+			}
+			long long memoryAfter = GetProcessPrivateBytes();
+			frameBytes = (asyncFrameBytes.load() - framesBefore) / std::max(1, numTasks);
+			while (probe.remaining.load() > 0) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			}
+			coroutineTime = (timestampNs() - start) / 1e9;
+			tickNs = wheel.tickNs();
+			coroutinePeak = probe.peak.load();
+			coroutineBytes = (memoryAfter - memoryBefore) / std::max(1, numTasks);
+		}
+		loadBalancer.shutdown();
+		coroutineLateness = probe.lateness;
+		coroutineSojourn = probe.sojourn;
 	}
-	fe.close();
-	fd.close();
+	logger.flush();
+	if (fineTimer) {
+		timeEndPeriod(1);
+	}
+
+	std::cout << "	Thread per task:\n";
+	std::cout << "		Peak concurrent tasks: " << threadPeak << ", " << threadBytes / 1024.0 << " KB committed per task\n";
+	std::cout << "		All done in " << threadTime << " s\n";
+	printLatency("Wake-up lateness", threadLateness);
+	printLatency("Sojourn", threadSojourn);
+	std::cout << "	Coroutines on " << numWorkers << " workers:\n";
+	std::cout << "		Peak concurrent tasks: " << coroutinePeak << ", " << coroutineBytes / 1024.0 << " KB committed per task, "
+		<< frameBytes << " byte frames\n";
+	std::cout << "		All done in " << coroutineTime << " s\n";
+	std::cout << "		Timer wheel tick: " << tickNs / 1e6 << " ms achieved for " << TIMER_TICK_NS / 1e6 << " ms asked, "
+		<< (fineTimer ? "1 ms timer resolution" : "default timer resolution") << "\n";
+	printLatency("Wake-up lateness", coroutineLateness);
+	printLatency("Sojourn", coroutineSojourn);
+
+	score += int(double(coroutinePeak) / std::max(1, threadPeak) * 10);
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
 }
 
-//load balacing
-void loadBalancing(int numWorkers, int numTasks, int& score) {
+void numaQueues(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
 	std::cout << "--------------------------------------------------------------\n";
-	std::cout << "Load balancing test for " << numWorkers << " and " << numTasks << "\n";
-	std::cout << "	Workers timers:\n";
+	std::cout << "NUMA hierarchical queues for " << numWorkers << " workers and " << numTasks << " tasks\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << serviceDistributionNames[workload.distribution] << " around "
+		<< workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	std::vector<GROUP_AFFINITY> nodes = numaNodeAffinities();
+	if (nodes.size() == 1) {
+		std::cout << "	Single node, the NUMA queues run unpinned with only the node-local steal level\n";
+	}
+	else {
+		std::cout << "	" << nodes.size() << " nodes:";
+		for (const GROUP_AFFINITY& node : nodes) {
+			KAFFINITY mask = node.Mask;
+			int cores = 0;
+			for (; mask != 0; mask &= mask - 1) {
+				cores++;
+			}
+			std::cout << " " << cores;
+		}
+		std::cout << " cores\n";
+	}
+
+	const SchedulerBackend backends[] = { GLOBAL_QUEUE, SHARDED_ROUND_ROBIN, NUMA_HIERARCHICAL };
+	float globalTime = 0.0f;
+	for (SchedulerBackend backend : backends) {
+		LoadBalancingResult result = runLoadBalancing(numWorkers, numTasks, defaultConfig(backend), workload);
+		std::cout << "	" << schedulerBackendNames[backend] << ":\n";
+		std::cout << "		Time to complete all tasks: " << result.time << ", " << result.tasks / result.time << " tasks/s\n";
+		// without uncore counters the Task payloads moved between nodes stand in for the remote traffic
+		std::cout << "		Steals: " << result.steals << ", within a node " << result.localSteals << ", across nodes " << result.remoteSteals << ", "
+			<< result.remoteSteals * sizeof(Task) / 1024.0 << " KB of remote Task payloads\n";
+		printLatency("Sojourn time", result.sojourn);
+
+		if (backend == GLOBAL_QUEUE) {
+			globalTime = result.time;
+		}
+		else if (backend == NUMA_HIERARCHICAL && result.time > 0) {
+			score += int(globalTime / result.time * 10);
+		}
+	}
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
+
+// one thread per recorded producer, each enqueues its own tasks at their recorded offsets from the replay start
+void replayTrace(LoadBalancer& loadBalancer, const TaskTrace& trace) {
+	const std::vector<TraceRecord>& records = trace.tasks();
+	long long start = timestampNs();
+	std::vector<std::thread> producers;
+	for (int p = 0; p < trace.producers(); ++p) {
+		producers.emplace_back([&, p]() {
+			for (size_t i = 0; i < records.size(); ++i) {
+				const TraceRecord& record = records[i];
+				if (record.producer != p) {
+					continue;
+				}
+				long long due = start + record.arrival;
+				Task task((int)i, TaskKind(record.kind), record.work);
+				task.priority = record.priority;
+				task.deadline = record.deadlineUs > 0 ? due + record.deadlineUs * 1000LL : 0;
+				waitUntil(due);
+				loadBalancer.enqueueTaskAt(task, due);
+			}
+		});
+	}
+	for (auto& producer : producers) {
+		producer.join();
+	}
+}
 
-	float time = 0;
+void traceReplay(int numWorkers, int numTasks, const WorkloadConfig& workload, int& score) {
+	std::cout << "--------------------------------------------------------------\n";
+	std::cout << "Trace record and replay for " << numWorkers << " workers and " << numTasks << " tasks\n";
+	std::cout << "	Tasks: " << taskKindNames[workload.kind] << ", " << serviceDistributionNames[workload.distribution] << " around "
+		<< workload.work << " " << taskKindUnits[workload.kind] << "\n";
+
+	// record: a few Poisson producers feed the global queue
+	double rate = numWorkers / measureMeanService(numWorkers, defaultConfig(GLOBAL_QUEUE), workload) * TRACE_LOAD;
+	TaskTrace recorded;
+	{
+		LoadBalancer loadBalancer(numWorkers, defaultConfig(GLOBAL_QUEUE));
+		loadBalancer.recordTrace(&recorded);
+		long long start = timestampNs();
+		std::vector<std::thread> producers;
+		for (int p = 0; p < TRACE_PRODUCERS; ++p) {
+			producers.emplace_back([&, p]() {
+				std::mt19937 random(workload.seed + p);
+				std::exponential_distribution<double> gap(rate / TRACE_PRODUCERS);
+				WorkloadConfig stream = workload;
+				stream.seed = workload.seed + p;
+				WorkSampler sampler(stream, numWorkers);
+				double arrival = 0.0;
+				for (int i = p; i < numTasks; i += TRACE_PRODUCERS) {
+					arrival += gap(random);
+					long long due = start + (long long)(arrival * 1e9);
+					waitUntil(due);
+					loadBalancer.enqueueTaskAt(Task(i, workload.kind, sampler.next()), due);
+				}
+			});
+		}
+		for (auto& producer : producers) {
+			producer.join();
+		}
+		loadBalancer.shutdown();
+	}
+	logger.flush();
+
+	if (!recorded.save(TRACE_FILE)) {
+		std::cout << "	Could not write the trace to " << TRACE_FILE << "\n";
+		std::cout << "--------------------------------------------------------------\n";
+		return;
+	}
+	// every replay reads the file back, so what was saved is what is compared
+	TaskTrace trace;
+	if (!trace.load(TRACE_FILE)) {
+		std::cout << "	Could not read the trace back from " << TRACE_FILE << "\n";
+		std::cout << "--------------------------------------------------------------\n";
+		return;
+	}
+	std::cout << "	Recorded " << trace.tasks().size() << " tasks from " << trace.producers() << " producers at " << rate << " tasks/s into "
+		<< TRACE_FILE << ", " << sizeof(TraceHeader) + trace.tasks().size() * sizeof(TraceRecord) << " bytes\n";
+
+	std::vector<double> throughput(BACKEND_COUNT), p50(BACKEND_COUNT), p99(BACKEND_COUNT), p999(BACKEND_COUNT);
+	std::vector<long long> steals(BACKEND_COUNT);
+	for (int backend = 0; backend < BACKEND_COUNT; backend++) {
+		LoadBalancer loadBalancer(numWorkers, defaultConfig(SchedulerBackend(backend)));
+		long long start = timestampNs();
+		replayTrace(loadBalancer, trace);
+		loadBalancer.waitIdle();
+		double time = (loadBalancer.lastCompletionTime() - start) / 1e9;
+		loadBalancer.shutdown();
+		logger.flush();
+
+		LatencyHistogram sojourn;
+		long long tasks = 0;
+		for (auto& stats : loadBalancer.getWorkerStats()) {
+			sojourn.merge(stats.sojourn);
+			tasks += stats.tasks;
+			steals[backend] += stats.steals;
+		}
+		throughput[backend] = tasks / time;
+		p50[backend] = sojourn.percentile(0.5) / 1e6;
+		p99[backend] = sojourn.percentile(0.99) / 1e6;
+		p999[backend] = sojourn.percentile(0.999) / 1e6;
+	}
+
+	std::cout << "	Replays side by side:\n		";
+	for (int backend = 0; backend < BACKEND_COUNT; backend++) {
+		std::cout << "	" << schedulerBackendNames[backend];
+	}
+	std::cout << "\n		tasks/s";
+	for (double value : throughput) {
+		std::cout << "	" << value;
+	}
+	std::cout << "\n		p50 ms";
+	for (double value : p50) {
+		std::cout << "	" << value;
+	}
+	std::cout << "\n		p99 ms";
+	for (double value : p99) {
+		std::cout << "	" << value;
+	}
+	std::cout << "\n		p99.9 ms";
+	for (double value : p999) {
+		std::cout << "	" << value;
+	}
+	std::cout << "\n		steals";
+	for (long long value : steals) {
+		std::cout << "	" << value;
+	}
+	std::cout << "\n";
+
+	// the best tail among backends that all saw the same stream
+	double bestP99 = *std::min_element(p99.begin(), p99.end());
+	score += int(100 / (1 + bestP99));
+
+	std::cout << "Score: " << score << "\n";
+	std::cout << "--------------------------------------------------------------\n";
+}
 
-	LoadBalancer loadBalancer(numWorkers);
+LoadBalancingResult runLoadBalancing(int numWorkers, int numTasks, const LoadBalancerConfig& config, const WorkloadConfig& workload) {
+	LoadBalancer loadBalancer(numWorkers, config);
+	// its thread start stays out of the measured cycles
+	QueueDepthSampler depthSampler(loadBalancer);
 
 	//measureStart
 	float total_time = 0.0;
@@ -1477,12 +6223,12 @@ void loadBalancing(int numWorkers, int numTasks, int& score) {
 		popad
 	}
 
+	WorkSampler sampler(workload, numWorkers);
 	for (int i = 0; i < numTasks; ++i) {
-		int processingTime = (i % numWorkers + 1) * 100; // Varying processing times
-		Task task(i, processingTime);
+		Task task(i, workload.kind, sampler.next());
 		loadBalancer.enqueueTask(task);
 	}
-	loadBalancer.~LoadBalancer();
+	loadBalancer.waitIdle();
 
 	//measureStop
 	__asm {
@@ -1497,12 +6243,27 @@ void loadBalancing(int numWorkers, int numTasks, int& score) {
 	temp_cycles2 = ((unsigned __int64)cycles_high2 << 32) | cycles_low2;
 	total_cycles = temp_cycles2 - temp_cycles1 - cpuid_time;
 
-	time = (float)total_cycles / (frequency * 1000000);
-
-	score += int(100000.0 / time);
-	score *= float(numTasks) / float(numWorkers) / 10.0;
+	loadBalancer.shutdown();
+	logger.flush();
+
+	LoadBalancingResult result;
+	result.depth = depthSampler.finish();
+	result.time = (float)total_cycles / (frequency * 1000000);
+	result.tasks = 0;
+	result.steals = 0;
+
+	for (auto& stats : loadBalancer.getWorkerStats()) {
+		result.tasks += stats.tasks;
+		result.steals += stats.steals;
+		result.wait.merge(stats.wait);
+		result.service.merge(stats.service);
+		result.sojourn.merge(stats.sojourn);
+		WorkerUsage usage = { stats.tasks, stats.steals, stats.busyCycles, stats.schedulerCycles, stats.idleCycles };
+		result.workers.push_back(usage);
+	}
+	result.imbalance = loadBalancer.queueImbalance();
+	result.localSteals = loadBalancer.nodeLocalSteals();
+	result.remoteSteals = loadBalancer.crossNodeSteals();
 
-	std::cout << "	Time to complete all tasks: " << time << "\n";
-	std::cout << "Score: " << score << "\n";
-	std::cout << "--------------------------------------------------------------\n";
+	return result;
 }